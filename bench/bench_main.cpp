@@ -0,0 +1,497 @@
+#include "Application.hpp"
+#include "GraphicsView.hpp"
+#include "Kernels.hpp"
+#include "Filters.hpp"
+#include "ImageCache.hpp"
+
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QFile>
+#include <QImage>
+#include <QPainter>
+#include <QLinearGradient>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <limits>
+
+using std::cerr ;
+using std::endl ;
+
+// Benchmarks for the core paths of imview, on synthetic fixtures. Every
+// case prints one line ; --json also writes them all as a report so runs
+// of different builds can be compared.
+class Bench {
+
+  public :
+
+  Bench (double min_seconds) : min_ns (static_cast<qint64> (min_seconds * 1e9)) { }
+
+  // fn is cheap : run it in calibrated batches and report the per-call cost
+  void micro (const QString & name, std::function<void ()> fn) {
+    qint64 batch = 1 ;
+    while (true) {
+      QElapsedTimer timer ;
+      timer.start () ;
+      for (qint64 i = 0 ; i < batch ; i++) { fn () ; }
+      if (timer.nsecsElapsed () > 1000000 || batch > (1 << 30)) { break ; }
+      batch *= 2 ;
+    }
+
+    qint64 total = 0, calls = 0 ;
+    double best = std::numeric_limits<double>::max () ;
+    while (total < min_ns) {
+      QElapsedTimer timer ;
+      timer.start () ;
+      for (qint64 i = 0 ; i < batch ; i++) { fn () ; }
+      auto elapsed = timer.nsecsElapsed () ;
+      total += elapsed ;
+      calls += batch ;
+      best = std::min (best, static_cast<double> (elapsed) / batch) ;
+    }
+
+    report (name, calls, static_cast<double> (total) / calls, best) ;
+  }
+
+  // fn is expensive : time each call, with setup kept out of the clock
+  void macro (const QString & name, int repeats,
+    std::function<void ()> setup, std::function<void ()> fn)
+  {
+    qint64 total = 0 ;
+    double best = std::numeric_limits<double>::max () ;
+    for (int i = 0 ; i < repeats ; i++) {
+      if (setup) { setup () ; }
+      QElapsedTimer timer ;
+      timer.start () ;
+      fn () ;
+      auto elapsed = timer.nsecsElapsed () ;
+      total += elapsed ;
+      best = std::min (best, static_cast<double> (elapsed)) ;
+    }
+
+    report (name, repeats, static_cast<double> (total) / repeats, best) ;
+  }
+
+  void report (const QString & name, qint64 iterations, double mean_ns, double best_ns) {
+    std::printf ("%-44s %14.1f ns/op  (min %14.1f)  x%lld\n",
+      name.toUtf8 ().constData (), mean_ns, best_ns,
+      static_cast<long long> (iterations)) ;
+    std::fflush (stdout) ;
+
+    QJsonObject obj ;
+    obj["name"] = name ;
+    obj["iterations"] = iterations ;
+    obj["mean_ns"] = mean_ns ;
+    obj["min_ns"] = best_ns ;
+    results << obj ;
+  }
+
+  QJsonArray results ;
+
+  private :
+
+  qint64 min_ns ;
+} ;
+
+static QList<int> int_list (const QString & text) {
+  QList<int> values ;
+  for (const auto & part : text.split (',', QString::SkipEmptyParts)) {
+    values << part.toInt () ;
+  }
+  return values ;
+}
+
+static void reset_app () {
+  app->all_contexts.clear () ;
+  app->contexts_by_id.clear () ;
+  app->current_context.reset () ;
+  app->current_state = nullptr ;
+  app->dirty_contexts.clear () ;
+  app->deleted_contexts.clear () ;
+}
+
+static bool open_fixture_db (const QString & file) {
+  if (QSqlDatabase::contains (QSqlDatabase::defaultConnection)) {
+    {
+      auto db = QSqlDatabase::database () ;
+      db.close () ;
+    }
+    QSqlDatabase::removeDatabase (QSqlDatabase::defaultConnection) ;
+  }
+  QFile::remove (file) ;
+  return setup_db (file) ;
+}
+
+static Application::Context::Ptr make_context (const QDir & dir, int size) {
+  auto ctx = Application::Context::Ptr::create () ;
+  ctx->dir = dir ;
+  for (int i = 0 ; i < size ; i++) {
+    ctx->images << QString ("practice_reference_%1.jpg").arg (i, 7, 10, QChar ('0')) ;
+  }
+  ctx->reset_states () ;
+  return ctx ;
+}
+
+static void bench_navigation (Bench & bench, const QList<int> & sizes) {
+  QDir dir ("/nonexistent") ;
+  for (auto size : sizes) {
+    auto ctx = make_context (dir, size) ;
+    bench.micro (QString ("step_image_index/%1").arg (size),
+      [ctx] () { ctx->step_image_index (7) ; }) ;
+    bench.micro (QString ("step_image_index_back/%1").arg (size),
+      [ctx] () { ctx->step_image_index (-3) ; }) ;
+  }
+
+  typedef Application::StepMode SM ;
+  for (auto mode : { SM::sm_15, SM::sm_22_5, SM::sm_45, SM::sm_120 }) {
+    double angle = 0 ;
+    bench.micro (QString ("nextAngle/%1").arg (stepmode_to_int (mode)),
+      [&angle, mode] () { if (! nextAngle (angle, mode)) { angle = 0 ; } }) ;
+    angle = 359 ;
+    bench.micro (QString ("nextAngle_back/%1").arg (stepmode_to_int (mode)),
+      [&angle, mode] () { if (! nextAngle (angle, mode, true)) { angle = 359 ; } }) ;
+  }
+}
+
+static void bench_dir_selected (Bench & bench, const QList<int> & sizes) {
+  for (auto size : sizes) {
+    QTemporaryDir tmp ;
+    QDir dir (tmp.path ()) ;
+    for (int i = 0 ; i < size ; i++) {
+      QFile file (dir.absoluteFilePath (QString ("ref_%1.jpg").arg (i, 7, 10, QChar ('0')))) ;
+      file.open (QIODevice::WriteOnly) ;
+    }
+
+    bench.macro (QString ("dir_selected/%1").arg (size), 5,
+      reset_app, [dir] () { app->dir_selected (dir) ; }) ;
+    reset_app () ;
+  }
+}
+
+static void bench_db (Bench & bench, const QList<int> & sizes, int dirty) {
+  QTemporaryDir tmp ;
+  QDir dir (tmp.path ()) ;
+
+  for (auto size : sizes) {
+    auto file = dir.absoluteFilePath (QString ("fixture_%1.sqlite").arg (size)) ;
+    if (! open_fixture_db (file)) {
+      cerr << "cannot create " << file.toStdString () << endl ;
+      return ;
+    }
+
+    int states = std::max (1, std::min (size, dirty)) ;
+    bench.macro (QString ("flush_to_db/insert/%1").arg (size), 1,
+      [&] () {
+        reset_app () ;
+        auto ctx = make_context (dir, size) ;
+        for (int i = 0 ; i < states ; i++) {
+          int index = i * (size / states) ;
+          ctx->state (index)->x = i ;
+          ctx->dirty_states.setBit (index) ;
+        }
+        app->add_context (ctx) ;
+        app->current_context = ctx ;
+        app->context_is_dirty (ctx) ;
+      },
+      [] () { app->flush_to_db () ; }) ;
+
+    bench.macro (QString ("read_from_db/%1").arg (size), 3,
+      reset_app, [] () { app->read_from_db () ; }) ;
+
+    bench.macro (QString ("flush_to_db/dirty/%1/%2").arg (size).arg (states), 3,
+      [&] () {
+        auto ctx = app->current_context ;
+        for (int i = 0 ; i < states ; i++) {
+          int index = (i * 7919) % size ;
+          ctx->state (index)->x += 1 ;
+          ctx->dirty_states.setBit (index) ;
+        }
+        app->context_is_dirty (ctx) ;
+      },
+      [] () { app->flush_to_db () ; }) ;
+
+    bench.macro (QString ("flush_to_db/clean/%1").arg (size), 3,
+      [] () { app->context_is_dirty () ; },
+      [] () { app->flush_to_db () ; }) ;
+  }
+
+  reset_app () ;
+}
+
+static QString size_label (QSize size) {
+  return QString ("%1x%2").arg (size.width ()).arg (size.height ()) ;
+}
+
+static QImage synthetic_image (QSize size) {
+  QImage image (size, QImage::Format_RGB32) ;
+  QPainter painter (&image) ;
+  QLinearGradient gradient (0, 0, size.width (), size.height ()) ;
+  gradient.setColorAt (0, Qt::darkCyan) ;
+  gradient.setColorAt (1, Qt::yellow) ;
+  painter.fillRect (image.rect (), gradient) ;
+  painter.setPen (QPen (Qt::white, 3)) ;
+  for (int x = 0 ; x < size.width () ; x += 64) {
+    painter.drawLine (x, 0, size.width () - x, size.height ()) ;
+  }
+  painter.end () ;
+  return image ;
+}
+
+// a context of one synthetic jpg per size
+static Application::Context::Ptr make_image_context (const QDir & dir, const QList<QSize> & sizes) {
+  auto ctx = Application::Context::Ptr::create () ;
+  ctx->dir = dir ;
+  for (auto size : sizes) {
+    auto image = synthetic_image (size) ;
+    auto name = QString ("ref_%1.jpg").arg (size_label (size)) ;
+    image.save (dir.absoluteFilePath (name), "JPG", 90) ;
+    ctx->images << name ;
+  }
+  ctx->reset_states () ;
+  return ctx ;
+}
+
+static void bench_context_refresh (Bench & bench, const QList<QSize> & sizes) {
+  QTemporaryDir tmp ;
+  QDir dir (tmp.path ()) ;
+  auto ctx = make_image_context (dir, sizes) ;
+
+  GraphicsView view ;
+  view.resize (800, 600) ;
+
+  for (int i = 0 ; i < sizes.size () ; i++) {
+    auto label = size_label (sizes.at (i)) ;
+    ctx->current_image_index = i ;
+
+    qint64 read = 0, decode = 0, upload = 0 ;
+    const int repeats = 5 ;
+    // every repeat reads and decodes, not just the first
+    bench.macro (QString ("context_refresh/%1").arg (label), repeats,
+      [] () { app->cache->clear () ; },
+      [&] () {
+        view.context_refresh (ctx) ;
+        read += view.last_refresh.read ;
+        decode += view.last_refresh.decode ;
+        upload += view.last_refresh.upload ;
+      }) ;
+    bench.report (QString ("context_refresh/read/%1").arg (label), repeats,
+      static_cast<double> (read) / repeats, 0) ;
+    bench.report (QString ("context_refresh/decode/%1").arg (label), repeats,
+      static_cast<double> (decode) / repeats, 0) ;
+    bench.report (QString ("context_refresh/upload/%1").arg (label), repeats,
+      static_cast<double> (upload) / repeats, 0) ;
+  }
+}
+
+// the pixel kernels on decoded images, with the instruction set in the
+// name ; run again with IMVIEW_ISA=scalar or sse2 to compare
+static void bench_filters (Bench & bench, const QList<QSize> & sizes) {
+  const int repeats = 5 ;
+  auto isa = Kernels::isa_name (Kernels::isa ()) ;
+  for (auto size : sizes) {
+    auto image = synthetic_image (size) ;
+    auto gray = Kernels::luminance (image) ;
+    auto label = QString ("%1/%2").arg (isa).arg (size_label (size)) ;
+
+    bench.macro (QString ("filters/luminance/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::luminance (image) ; }) ;
+    bench.macro (QString ("filters/posterize5/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::posterize (gray, 5) ; }) ;
+    bench.macro (QString ("filters/halve/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::halve (image) ; }) ;
+    bench.macro (QString ("filters/histograms/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::histograms (image) ; }) ;
+    bench.macro (QString ("filters/edges/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::edges (image, 48) ; }) ;
+    // what every move of the comparison costs in difference mode
+    auto study = image.mirrored (true, false) ;
+    bench.macro (QString ("filters/difference/%1").arg (label), repeats, nullptr,
+      [&] () { Kernels::difference (image, study, QPoint (7, 5)) ; }) ;
+
+    for (int radius : { 4, 16 }) {
+      bench.macro (QString ("filters/box_blur%1/%2").arg (radius).arg (label), repeats, nullptr,
+        [&] () { Kernels::box_blur (image, radius) ; }) ;
+    }
+
+    Filters::Spec spec ;
+    spec.value = Filters::notan3 ;
+    bench.macro (QString ("filters/notan3/%1").arg (label), repeats, nullptr,
+      [&] () { Filters::apply (image, spec) ; }) ;
+
+    // the way the view squints : a large radius on the level it picks
+    Filters::Spec squint ;
+    squint.blur = 64 ;
+    QVector<QImage> levels { image } ;
+    auto source = Filters::source_level (squint, image.size (), 0) ;
+    while (levels.size () <= source) { levels << Kernels::halve (levels.last ()) ; }
+    bench.macro (QString ("filters/squint64/%1").arg (label), repeats, nullptr,
+      [&] () { Filters::apply (levels.at (source), squint, source) ; }) ;
+  }
+}
+
+struct RenderCase {
+  QList<QSize> sizes ;
+  QList<double> zooms ;
+  QList<double> angles ;
+  QStringList hints ;
+  int frames ;
+} ;
+
+// frames of the real view for every combination of image size, zoom,
+// angle, mirroring and render hints, transformed through the application
+// entry points like the user would
+static void bench_render (Bench & bench, const RenderCase & cases) {
+  QTemporaryDir tmp ;
+  QDir dir (tmp.path ()) ;
+  auto ctx = make_image_context (dir, cases.sizes) ;
+
+  reset_app () ;
+  app->add_context (ctx) ;
+  app->current_context = ctx ;
+
+  GraphicsView view ;
+  view.resize (800, 600) ;
+  view.show () ;
+
+  for (int i = 0 ; i < cases.sizes.size () ; i++) {
+    app->on_imgJumpSpecific (i) ;
+    if (i == 0) {
+      // already at 0, refresh by hand
+      app->state_refreshed (true) ;
+      view.context_refresh (ctx) ;
+      app->state_refreshed () ;
+    }
+    if (! view.img_item) {
+      cerr << "render : cannot show " << size_label (cases.sizes.at (i)).toStdString () << endl ;
+      continue ;
+    }
+
+    for (const auto & hint : cases.hints) {
+      QPainter::RenderHints render_hints ;
+      if (hint.contains ("aa")) { render_hints |= QPainter::Antialiasing ; }
+      bool smooth = hint.contains ("smooth") ;
+      if (smooth) { render_hints |= QPainter::SmoothPixmapTransform ; }
+      view.setRenderHints (render_hints) ;
+
+      // the items ask for smooth scaling themselves, follow the hint
+      auto mode = smooth ? Qt::SmoothTransformation : Qt::FastTransformation ;
+      view.img_item->setTransformationMode (mode) ;
+      view.img_mirrored_item->setTransformationMode (mode) ;
+
+      for (auto z : cases.zooms) {
+        app->on_zoom (z) ;
+        for (auto angle : cases.angles) {
+          app->on_rotation (angle) ;
+          for (bool mirrored : { false, true }) {
+            if (app->current_state->mirrored != mirrored) { app->on_mirrorToggle () ; }
+
+            auto name = QString ("render/%1/z%2/r%3/%4/%5")
+              .arg (size_label (cases.sizes.at (i)))
+              .arg (z).arg (angle)
+              .arg (mirrored ? "mirrored" : "plain")
+              .arg (hint) ;
+            bench.macro (name, cases.frames, nullptr,
+              [&view] () { view.viewport ()->repaint () ; }) ;
+          }
+        }
+      }
+    }
+  }
+
+  reset_app () ;
+}
+
+static QList<QSize> size_list (const QString & text) {
+  QList<QSize> sizes ;
+  for (const auto & part : text.split (',', QString::SkipEmptyParts)) {
+    auto wh = part.split ('x') ;
+    if (wh.size () == 2) { sizes << QSize (wh.at (0).toInt (), wh.at (1).toInt ()) ; }
+  }
+  return sizes ;
+}
+
+static QList<double> double_list (const QString & text) {
+  QList<double> values ;
+  for (const auto & part : text.split (',', QString::SkipEmptyParts)) {
+    values << part.toDouble () ;
+  }
+  return values ;
+}
+
+int
+main (int argc, char ** argv) {
+  if (qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")) {
+    qputenv ("QT_QPA_PLATFORM", "offscreen") ;
+  }
+
+  QStringList arguments ;
+  for (int i = 0 ; i < argc ; i++) { arguments << QString::fromLocal8Bit (argv[i]) ; }
+
+  // the application parses its own command line, keep ours away from it
+  int app_argc = 1 ;
+  auto _app = Application (app_argc, argv) ;
+
+  QCommandLineParser parser ;
+  parser.setApplicationDescription ("imview core path benchmarks") ;
+  parser.addHelpOption () ;
+  parser.addOption ({ "sizes", "Context sizes, in images.", "n,...", "1000,100000,1000000" }) ;
+  parser.addOption ({ "dirty", "Dirty states per flush.", "n", "5000" }) ;
+  parser.addOption ({ "dir-sizes", "Directory sizes for dir_selected.", "n,...", "1000,10000" }) ;
+  parser.addOption ({ "image-sizes", "Decoded image sizes.", "WxH,...", "1024x768,4000x3000,7360x4912" }) ;
+  parser.addOption ({ "render-sizes", "Image sizes for render.", "WxH,...", "1024x768,4000x3000" }) ;
+  parser.addOption ({ "render-zooms", "ImageState::z values for render, 0.05 to 20.", "z,...", "0.05,1,4,20" }) ;
+  parser.addOption ({ "render-angles", "Rotations for render.", "deg,...", "0,15,22.5,30,45,120" }) ;
+  parser.addOption ({ "render-hints", "Render hints for render.", "none|aa|smooth|aa+smooth,...",
+    "none,aa,smooth,aa+smooth" }) ;
+  parser.addOption ({ "frames", "Frames per render case.", "n", "10" }) ;
+  parser.addOption ({ "min-time", "Seconds spent per micro benchmark.", "s", "0.3" }) ;
+  parser.addOption ({ "filter", "Only run groups containing <text> (nav, dir, db, refresh, filters, render).", "text" }) ;
+  parser.addOption ({ "json", "Write the report to <file>.", "file" }) ;
+  parser.process (arguments) ;
+
+  auto image_sizes = size_list (parser.value ("image-sizes")) ;
+
+  Bench bench (parser.value ("min-time").toDouble ()) ;
+  auto filter = parser.value ("filter") ;
+  auto wanted = [&filter] (const char * group) {
+    return filter.isEmpty () || QString (group).contains (filter) ;
+  } ;
+
+  if (wanted ("nav")) { bench_navigation (bench, int_list (parser.value ("sizes"))) ; }
+  if (wanted ("dir")) { bench_dir_selected (bench, int_list (parser.value ("dir-sizes"))) ; }
+  if (wanted ("db")) {
+    bench_db (bench, int_list (parser.value ("sizes")), parser.value ("dirty").toInt ()) ;
+  }
+  if (wanted ("refresh")) { bench_context_refresh (bench, image_sizes) ; }
+  if (wanted ("filters")) { bench_filters (bench, image_sizes) ; }
+  if (wanted ("render")) {
+    RenderCase cases {
+      size_list (parser.value ("render-sizes")),
+      double_list (parser.value ("render-zooms")),
+      double_list (parser.value ("render-angles")),
+      parser.value ("render-hints").split (',', QString::SkipEmptyParts),
+      qMax (1, parser.value ("frames").toInt ())
+    } ;
+    bench_render (bench, cases) ;
+  }
+
+  if (parser.isSet ("json")) {
+    QFile file (parser.value ("json")) ;
+    if (! file.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+      cerr << "cannot write " << file.fileName ().toStdString () << endl ;
+      return EXIT_FAILURE ;
+    }
+    QJsonObject report ;
+    report["results"] = bench.results ;
+    file.write (QJsonDocument (report).toJson (QJsonDocument::Indented)) ;
+  }
+
+  return EXIT_SUCCESS ;
+}
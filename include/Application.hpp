@@ -1,3 +1,11 @@
+#pragma once
+
+#include "FilenameStore.hpp"
+#include "PerfStats.hpp"
+#include "MemStats.hpp"
+#include "Permutation.hpp"
+#include "Filters.hpp"
+
 #include <QApplication>
 #include <QDir>
 #include <QUuid>
@@ -5,11 +13,21 @@
 #include <QSharedPointer>
 #include <QHash>
 #include <QSet>
+#include <QBitArray>
+#include <QVector>
 #include <QWidget>
 #include <QString>
+#include <QCommandLineParser>
+#include <QJsonObject>
 
 #include <iostream>
 
+class CommandProcessor ;
+class Recorder ;
+class ImageCache ;
+class PracticeTimer ;
+class PaletteService ;
+
 class Application : public QApplication {
 
   Q_OBJECT
@@ -21,6 +39,14 @@ class Application : public QApplication {
 
   int exec (QWidget * mainWidget) ;
 
+  // stamps input and timer events for the per switch latency breakdown
+  virtual bool eventFilter (QObject * watched, QEvent * evt) ;
+
+  // modes that run without a main window, on the offscreen platform
+  static bool is_headless (int argc, char ** argv) ;
+  bool headless () const ;
+  int exec_headless () ;
+
   enum class StepMode {
     sm_Normal,
     sm_15,
@@ -33,8 +59,6 @@ class Application : public QApplication {
   class ImageState {
     public :
 
-    typedef QSharedPointer<ImageState> Ptr ;
-
     double x, y ;
     double z ;
     double rot ;
@@ -56,12 +80,35 @@ class Application : public QApplication {
 
     QUuid id ;
     QDir dir ;
-    QStringList images ;
+    FilenameStore images ;
     int current_image_index ;
-    QHash<int,ImageState::Ptr> states ;
     StepMode stepMode ;
 
-    QSet<int> dirty_states ;
+    // dense, indexed by image index and sized along with images ; entries
+    // that were never touched hold the default state and are not set in
+    // stateful, so they are not persisted
+    QVector<ImageState> states ;
+    QBitArray stateful ;
+
+    // context-wide transform, stored once : each field group remembers the
+    // generation it was last applied at and overrides every state that was
+    // last resolved at an older generation
+    ImageState base ;
+    int generation ;
+    int rot_gen, mirror_gen, place_gen ;
+    QVector<int> state_gens ;
+
+    QBitArray dirty_states ;
+
+    // shuffle mode : navigation walks image indices in the order of a
+    // seeded permutation, only the seed is persisted
+    bool shuffled ;
+    Permutation order ;
+
+    // shadow of what flush_to_db has committed, so a flush never has to
+    // query the db to choose between insert and update
+    bool persisted ;
+    QBitArray persisted_states ;
 
     Context () ;
     Context (QUuid id, QDir dir, int current_image_index, StepMode mode) ;
@@ -69,19 +116,87 @@ class Application : public QApplication {
     bool operator == (const Context &other) ;
 
     bool step_image_index (int step) ;
+    // image index step_image_index (step) would land on, -1 when empty
+    int upcoming_index (int step) const ;
+    // the same from another index, where a second view stands
+    int upcoming_index (int from, int step) const ;
+
+    void reset_states () ;
+    bool has_state (int index) const ;
+    ImageState * state (int index) ;
+    ImageState effective_state (int index) const ;
+
+    // heap held by the states and their bitmaps
+    qint64 state_bytes () const ;
   } ;
 
+  // registry : all_contexts keeps the user visible order, contexts_by_id
+  // answers lookups
   Context::List all_contexts ;
+  QHash<QUuid,Context::Ptr> contexts_by_id ;
   Context::Ptr current_context ;
-  ImageState::Ptr current_state ;
+  ImageState * current_state ;
 
   QSet<QUuid> dirty_contexts ;
   QSet<QUuid> deleted_contexts ;
 
+  QCommandLineParser cmdline ;
+  CommandProcessor * commands ;
+  // set while --record is writing the entry point calls
+  Recorder * recorder ;
+  ImageCache * cache ;
+  PracticeTimer * practice ;
+  PaletteService * palettes ;
+  // applied to what the view shows, not persisted
+  Filters::Spec view_filter ;
+  // the view that follows the current context when the window is split,
+  // null when there is a single view
+  QWidget * active_view ;
+  // the active view's own transform for an image whose stored state was
+  // changed from another view : shown and edited in its place, never
+  // saved ; showing any other image drops it. index is -1 when unset
+  struct StateOverride {
+    QUuid context ;
+    int index ;
+    ImageState state ;
+  } state_override ;
+  // edge overlay threshold, 0 when the overlay is off
+  int edge_threshold ;
+  // a second image drawn over the one on show, a study to compare with
+  // it ; fitted and centred on it, then moved by x, y in its pixels
+  struct Compare {
+    QString file ;
+    int opacity ;
+    bool difference ;
+    double x, y ;
+  } compare ;
+  // board mode shows these images of the current context together, all
+  // of them when empty
+  bool board ;
+  QVector<int> board_images ;
+
+  // while batch_depth > 0 image changes are coalesced and the view is only
+  // refreshed once, when the outermost batch ends
+  int batch_depth ;
+  bool batch_img_changed ;
+
+  PerfStats perf ;
+  MemStats mem ;
+
+  // where the trace is dumped on exit, empty when tracing is off
+  QString trace_file ;
+
   bool move_grabbed, scale_grabbed ;
   double grab_x, grab_y ;
   double x1, y1 ;
 
+  Context::Ptr find_context (const QUuid & id) const ;
+  Context::Ptr match_context (const QString & text) const ;
+  void add_context (Context::Ptr ctx) ;
+  void remove_context (Context::Ptr ctx) ;
+  // recounts the filenames and states categories of mem
+  void account_contexts () ;
+
   void dir_selected (const QDir & dir) ;
   void state_refreshed (bool just_update_state = false) ;
   void move_grab (double x, double y) ;
@@ -94,6 +209,7 @@ class Application : public QApplication {
 
   void on_resize () ;
   void on_rotation (double value) ;
+  void on_zoom (double z) ;
   void on_discrete_rotation () ;
   void on_mirrorToggle () ;
   void on_nextImage () ;
@@ -107,6 +223,32 @@ class Application : public QApplication {
   void on_context_deletion (QUuid id) ;
   void on_context_wide_rot_mirror (double rot, bool mirror) ;
   void on_transform_others () ;
+  void on_shuffle (bool on, quint32 seed) ;
+  void on_value_filter (int value) ;
+  // squint : blur radius in image pixels, 0 turns it off
+  // settled is false while a slider is being dragged, the upcoming image
+  // is prefetched once it is released
+  void on_blur (int radius, bool settled = true) ;
+  // edges over the image, threshold 1 to 255, 0 turns them off
+  void on_edges (int threshold) ;
+  // an empty file takes the comparison away
+  void on_compare_open (const QString & file) ;
+  void on_compare_opacity (int percent) ;
+  void on_compare_difference (bool on) ;
+  void on_compare_offset (double x, double y) ;
+  void on_board (bool on, const QVector<int> & images = QVector<int> ()) ;
+  // state for image index of ctx from the next refresh on, when it
+  // differs from the stored one
+  void override_state (Context::Ptr ctx, int index, const ImageState & state) ;
+
+  void begin_batch () ;
+  void end_batch () ;
+  void sync_batch () ;
+  void notify_img_changed () ;
+  // decodes what the next navigation step will show, in the background
+  void prefetch_upcoming () ;
+  // palette of the image on show, and of the next one when idle
+  void request_palette () ;
 
   void flush_to_db () ;
   bool read_from_db () ;
@@ -118,7 +260,10 @@ class Application : public QApplication {
 
   signals:
 
-  void all_contexts_changed (Context::List all_contexts) ;
+  void contexts_reset () ;
+  void context_added (Context::Ptr context) ;
+  void context_removed (QUuid id) ;
+  void context_changed (Context::Ptr context) ;
   void current_context_changed (Context::Ptr current_context) ;
   void current_img_changed (Context::Ptr context) ;
   void img_translate (double dx, double dy) ;
@@ -126,8 +271,11 @@ class Application : public QApplication {
   void img_rotate (double rotate) ;
   void img_scale (double scale) ;
   void img_mirror (bool value) ;
+  void view_filter_changed () ;
+  void edges_changed () ;
+  void compare_changed () ;
+  void board_changed () ;
   void resized () ;
-  void cmdline (const QString &line) ;
   void img_copy();
   void status_bar_msg(const QString &msg);
 
@@ -135,6 +283,12 @@ class Application : public QApplication {
   void on_startup () ;
 
   private :
+  bool open_backend () ;
+  int run_export () ;
+  int run_nav_bench () ;
+  int run_replay () ;
+  bool write_report (const QJsonObject & report) ;
+  void finish_trace () ;
   void dump_cur_state () ;
 } ;
 
@@ -145,4 +299,7 @@ std::ostream& operator << (std::ostream & out, const QPointF x) ;
 
 int stepmode_to_int (Application::StepMode mode) ;
 Application::StepMode int_to_stepmode (int imode) ;
+bool nextAngle (double & angle, Application::StepMode mode, bool backwards = false) ;
+
+bool setup_db (const QString & file) ;
 
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Application.hpp"
+
+#include <QGraphicsView>
+#include <QGraphicsItem>
+#include <QSharedPointer>
+#include <QPixmap>
+#include <QHash>
+
+class BoardView ;
+
+// One image of the board. It is sized from the cell until the image is
+// decoded, then fitted in it ; paint () draws the pyramid level that
+// matches the zoom when it is cached, and asks for it otherwise.
+class BoardItem : public QGraphicsItem {
+
+  public :
+
+  BoardItem (BoardView * board, const QString & file, int index, qreal cell) ;
+
+  virtual QRectF boundingRect () const ;
+  virtual void paint (QPainter * painter, const QStyleOptionGraphicsItem * option,
+    QWidget * widget) ;
+
+  // the cache has something new for the file, full is its size
+  void prepared (const QSize & full) ;
+  // drops the pixmap, the next paint fetches it again
+  void release () ;
+
+  QString file ;
+  int index ;
+
+  private :
+
+  BoardView * board ;
+  qreal cell ;
+  // of the full image, empty until it is decoded
+  QSize size ;
+  QPixmap pixmap ;
+  int level ;
+  // a prefetch was asked for and has not come back
+  bool pending ;
+} ;
+
+// Board mode : the images of a context laid out on one canvas, each with
+// the rotation, mirror and zoom of its ImageState, placement comes from
+// the grid. The scene's BSP index culls what is off screen, so only the
+// visible items paint ; they draw from the shared cache at the level the
+// zoom needs, and are decoded in the background the first time they show.
+// Dragging pans, the wheel zooms, a double click opens the image.
+class BoardView : public QGraphicsView {
+
+  Q_OBJECT
+
+  public :
+
+  BoardView (QWidget * parent = nullptr) ;
+  ~BoardView () ;
+
+  // indices empty for all the images of ctx
+  void show_context (Application::Context::Ptr ctx, const QVector<int> & indices) ;
+  void clear () ;
+
+  // called by the items for the pixmaps they hold
+  void account (qint64 delta) ;
+
+  protected :
+
+  virtual void wheelEvent (QWheelEvent * evt) ;
+  virtual void mouseDoubleClickEvent (QMouseEvent * evt) ;
+
+  private :
+
+  void refresh () ;
+  // releases what is off screen once pixmaps go over their budget
+  void trim () ;
+
+  QSharedPointer<QGraphicsScene> scene ;
+  QHash<QString,BoardItem *> items ;
+  qint64 pixmap_bytes ;
+} ;
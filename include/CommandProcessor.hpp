@@ -0,0 +1,99 @@
+#pragma once
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QJsonValue>
+#include <QJsonObject>
+
+#include <functional>
+
+// accumulates raw bytes and hands back complete lines, so readers never
+// block on a partial line
+class LineBuffer {
+
+  public :
+
+  static const int max_line = 1 << 20 ;
+
+  void feed (const char * data, qint64 size) ;
+  QStringList take_lines () ;
+  // whatever follows the last newline, once the input has ended
+  QString take_rest () ;
+
+  private :
+
+  QByteArray pending ;
+} ;
+
+// line oriented control protocol, shared by every channel that can drive
+// the viewer. Each line is "[@tag] command args..." and gets exactly one
+// json response line back. Lines handed over together run as one batch :
+// image changes inside a batch are coalesced into a single refresh.
+// Channels may also subscribe to events, which are pushed as json lines.
+class CommandProcessor : public QObject {
+
+  Q_OBJECT
+
+  public :
+
+  // one connected channel (stdin, a socket client, ...)
+  class Session {
+    public :
+
+    Session () ;
+    virtual ~Session () ;
+    virtual void send (const QByteArray & line) = 0 ;
+    virtual void flush () ;
+
+    QSet<QString> subscriptions ;
+    // batches this session opened with begin and has not ended yet
+    int open_batches ;
+  } ;
+
+  struct Request {
+    Session * session ;
+    QString tag ;
+    QString name ;
+    QStringList args ;
+    QString rest ;
+  } ;
+
+  // fills result on success, or an error message and returns false
+  typedef std::function<bool (const Request & req, QJsonValue & result)> Handler ;
+
+  CommandProcessor (QObject * parent) ;
+  ~CommandProcessor () ;
+
+  void add_command (const QString & name, const QString & usage, Handler handler) ;
+
+  QByteArray execute (const QString & line, Session * session) ;
+  void execute_batch (const QStringList & lines, Session * session) ;
+
+  void add_session (Session * session) ;
+  // also ends the batches the session left open
+  void remove_session (Session * session) ;
+  void publish (const QString & event, const QJsonObject & data) ;
+
+  void attach_stdin () ;
+
+  private :
+
+  struct Command {
+    QString usage ;
+    Handler handler ;
+  } ;
+
+  void add_builtin_commands () ;
+  // those left open by a session that will not send end any more
+  void end_batches (Session * session) ;
+
+  QHash<QString,Command> commands ;
+  QList<Session*> sessions ;
+  Session * stdin_session ;
+  LineBuffer stdin_buffer ;
+} ;
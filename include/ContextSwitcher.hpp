@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Application.hpp"
+
+#include <QAbstractListModel>
+#include <QSortFilterProxyModel>
+#include <QDialog>
+#include <QLineEdit>
+#include <QListView>
+#include <QVector>
+#include <QHash>
+
+// list model over the application's context registry, kept up to date from
+// the fine grained context_* signals rather than rebuilt
+class ContextListModel : public QAbstractListModel {
+
+  Q_OBJECT
+
+  public :
+
+  ContextListModel (QObject * parent) ;
+  ~ContextListModel () ;
+
+  static const int IdRole = Qt::UserRole + 1 ;
+
+  virtual int rowCount (const QModelIndex & parent = QModelIndex ()) const ;
+  virtual QVariant data (const QModelIndex & index, int role) const ;
+
+  private :
+
+  void reset () ;
+  void added (Application::Context::Ptr ctx) ;
+  void removed (QUuid id) ;
+  void changed (Application::Context::Ptr ctx) ;
+  void current_changed (Application::Context::Ptr ctx) ;
+  void reindex (int from) ;
+
+  QVector<Application::Context::Ptr> rows ;
+  QHash<QUuid,int> row_of ;
+  QUuid current_id ;
+} ;
+
+class ContextSwitcher : public QDialog {
+
+  Q_OBJECT
+
+  public :
+
+  ContextSwitcher (QWidget * parent) ;
+  ~ContextSwitcher () ;
+
+  void popup () ;
+
+  protected :
+
+  virtual bool eventFilter (QObject * obj, QEvent * evt) ;
+
+  private :
+
+  void activate (const QModelIndex & index) ;
+
+  ContextListModel * model ;
+  QSortFilterProxyModel * proxy ;
+  QLineEdit * search ;
+  QListView * list ;
+} ;
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "CommandProcessor.hpp"
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+
+// local socket endpoint speaking the CommandProcessor protocol, so any
+// number of clients can drive and observe a running viewer at once
+class ControlServer : public QObject {
+
+  Q_OBJECT
+
+  public :
+
+  ControlServer (CommandProcessor * commands, QObject * parent) ;
+  ~ControlServer () ;
+
+  bool listen (const QString & name) ;
+  QString serverName () const ;
+
+  private :
+
+  class Client ;
+
+  void on_connection () ;
+  void on_ready_read (QLocalSocket * socket) ;
+  void on_disconnected (QLocalSocket * socket) ;
+
+  CommandProcessor * commands ;
+  QLocalServer * server ;
+  QHash<QLocalSocket*,Client*> clients ;
+} ;
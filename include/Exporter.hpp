@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Application.hpp"
+
+#include <QString>
+#include <QSize>
+#include <QImage>
+
+// Renders a context's images with their saved transform into files. Every
+// image is an independent job on a thread pool of `jobs` workers, and a
+// worker holds one decoded image at a time, so memory stays bounded by the
+// pool size whatever the context size. Only QImage is touched off the gui
+// thread, which keeps this usable under the offscreen platform.
+class Exporter {
+
+  public :
+
+  Exporter (const QString & out_dir, const QString & format, QSize canvas, int jobs) ;
+  ~Exporter () ;
+
+  // returns the number of images that failed
+  int run (Application::Context::Ptr ctx) ;
+
+  // canvas of QSize () crops to the transformed image, otherwise the image
+  // is framed like the view would show it in a canvas of that size
+  static QImage render (const QImage & image,
+    const Application::ImageState & state, QSize canvas) ;
+
+  private :
+
+  QString out_dir ;
+  QString format ;
+  QSize canvas ;
+  int jobs ;
+} ;
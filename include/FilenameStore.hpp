@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+// Compact, append-only list of file names. Names are kept as UTF-8 in one
+// arena, front coded in buckets of bucket_size : the first name of a bucket
+// is stored whole, every other one as (shared prefix, suffix) against the
+// name before it. Indexed access decodes at most one bucket.
+class FilenameStore {
+
+  public :
+
+  static const int bucket_size = 16 ;
+
+  FilenameStore () ;
+  ~FilenameStore () ;
+
+  int size () const ;
+  bool isEmpty () const ;
+  void clear () ;
+
+  void append (const QString & name) ;
+  void push_back (const QString & name) ;
+  FilenameStore & operator << (const QString & name) ;
+
+  QString at (int index) const ;
+  QString operator [] (int index) const ;
+
+  // bytes held by the arena and the bucket index
+  qint64 bytes () const ;
+
+  // sequential walk, reusing a single decode buffer
+  class Cursor {
+    public :
+
+    Cursor (const FilenameStore & store) ;
+
+    bool next () ;
+    int index () const ;
+    const QByteArray & utf8 () const ;
+    QString name () const ;
+
+    private :
+
+    const FilenameStore & store ;
+    int current ;
+    int offset ;
+    QByteArray buffer ;
+  } ;
+
+  private :
+
+  int decode (int offset, QByteArray & name) const ;
+
+  QByteArray data ;
+  QVector<quint32> bucket_offsets ;
+  QByteArray last_name ;
+  int num_names ;
+} ;
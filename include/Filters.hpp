@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+#include <QSize>
+
+// Study filters over what the view shows. They run on the pyramid level
+// picked for the zoom, so their cost follows what is on screen, and the
+// results are cached under the spec's tag next to the level.
+class Filters {
+
+  public :
+
+  enum Value : quint8 { none, grayscale, notan2, notan3, notan5, value_count } ;
+
+  // squint radius, in pixels of the full image
+  static const int max_blur = 255 ;
+
+  struct Spec {
+    Value value ;
+    int blur ;
+
+    Spec () : value (none), blur (0) { }
+
+    // 0 for the unfiltered image
+    quint32 tag () const { return value | quint32 (blur) << 8 ; }
+    bool operator == (const Spec & other) const { return tag () == other.tag () ; }
+    bool operator != (const Spec & other) const { return tag () != other.tag () ; }
+  } ;
+
+  // edge magnitude cache tag, apart from every spec's
+  static const quint32 edge_tag = 1u << 24 ;
+
+  static const char * value_name (Value value) ;
+  static bool value_from_name (const QString & name, Value & value) ;
+
+  // pyramid level a view at level n is computed from : large blur radii
+  // lose nothing on a smaller level, and cost much less there
+  static int source_level (const Spec & spec, const QSize & size, int n) ;
+
+  // image is level n of the full image, the blur radius scales with it
+  static QImage apply (const QImage & image, const Spec & spec, int n = 0) ;
+
+  // contours over transparency, stronger edges more opaque, to be drawn
+  // on top of the image they come from ; magnitude is Kernels::edges of
+  // that image at threshold 0, the threshold applies here
+  static QImage edges (const QImage & magnitude, int threshold) ;
+} ;
@@ -5,6 +5,7 @@
 #include <QGraphicsPixmapItem>
 #include <QWheelEvent>
 #include <QKeyEvent>
+#include <QFocusEvent>
 
 class GraphicsView : public QGraphicsView {
 
@@ -22,19 +23,76 @@ class GraphicsView : public QGraphicsView {
   virtual void mouseMoveEvent (QMouseEvent* evt) ;
   virtual void wheelEvent (QWheelEvent* evt) ;
   virtual void keyPressEvent (QKeyEvent* evt) ;
+  virtual void focusInEvent (QFocusEvent* evt) ;
+  virtual void paintEvent (QPaintEvent* evt) ;
+  virtual void drawForeground (QPainter* painter, const QRectF & rect) ;
 
   QSharedPointer<QGraphicsScene> scene ;
   QGraphicsPixmapItem *img_item ;
   QGraphicsPixmapItem *img_mirrored_item ;
   QGraphicsItem *rotscale_item ;
+  // edge overlays, children of the image items so they follow them
+  QGraphicsPixmapItem *edge_item ;
+  QGraphicsPixmapItem *edge_mirrored_item ;
+  // the comparison image, the same way
+  QGraphicsPixmapItem *compare_item ;
+  QGraphicsPixmapItem *compare_mirrored_item ;
   QImage copied_image;
 
+  // the decoded image on show, and the pyramid level it is drawn from
+  QString shown_file ;
+  QImage shown_image ;
+  int shown_level ;
+
+  // timings of the last context_refresh, in nanoseconds
+  struct RefreshTiming {
+    qint64 decode ;
+    qint64 upload ;
+    qint64 read ;
+  } last_refresh ;
+
+  // draws app->perf over the image
+  bool show_perf ;
+
+  // whether the view follows the current context, see SplitView
+  bool active () const ;
+
   public slots :
   void context_refresh (Application::Context::Ptr context) ;
+  void set_perf_overlay (bool visible) ;
+  // redraws the items from another level or filter, keeping their place
+  void show_level (int level) ;
+
+  private :
+  void upload (const QImage & image) ;
+  // this view's share of MemStats::pixels and mirrored
+  void account (qint64 pixels, qint64 mirrored) ;
+  void show_edges () ;
+  // maps an overlay the size of the level on show onto the image items,
+  // which hold a smaller image when a filter ran on a deeper level
+  QTransform overlay_transform (const QSize & size) const ;
+  void show_compare () ;
+  // where the pointer is, in pixels of the image on show
+  QPointF image_point (const QPoint & pos) const ;
+
+  // the comparison as decoded, and fitted on the level on show
+  QString compare_file ;
+  QImage compare_image ;
+  QImage compare_fitted ;
+  // the fitted image is uploaded once, differences every time
+  qint64 compare_uploaded ;
+  // shift dragging moves the comparison
+  bool compare_grabbed ;
+  QPointF compare_grab ;
+
+  qint64 pixel_bytes ;
+  qint64 mirrored_bytes ;
 
   signals :
   void log_no_context () ;
   void log_no_images () ;
   void log_image_index (int i, int t) ;
+  void switch_painted () ;
+  void focused () ;
 } ;
 
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Application.hpp"
+#include "Kernels.hpp"
+
+#include <QWidget>
+#include <QThreadPool>
+
+// value and RGB distributions of the image on show. They are counted on a
+// worker once the image changed, over a pyramid level of about a
+// megapixel, and drawn when they arrive ; the view never waits on them.
+class HistogramView : public QWidget {
+
+  Q_OBJECT
+
+  public :
+
+  HistogramView (QWidget * parent = nullptr) ;
+  ~HistogramView () ;
+
+  virtual QSize sizeHint () const ;
+
+  // counting only happens while the panel is visible
+  void set_active (bool active) ;
+
+  // called on the gui thread when a worker is done
+  void finished (quint64 generation, const Kernels::Histograms & counts) ;
+
+  protected :
+
+  virtual void paintEvent (QPaintEvent * evt) ;
+
+  private :
+
+  void image_changed () ;
+
+  bool active ;
+  bool counted ;
+  // bumped on every change, results of older requests are dropped
+  quint64 generation ;
+  Kernels::Histograms counts ;
+  QThreadPool pool ;
+} ;
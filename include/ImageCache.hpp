@@ -0,0 +1,119 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QSize>
+#include <QSizeF>
+#include <QList>
+
+#include "Filters.hpp"
+
+// Decoded images by absolute file name, bounded by a byte budget with
+// least recently used eviction. prefetch () decodes on a worker thread ;
+// get () hands the image over, waiting for a prefetch still in flight
+// rather than decoding the file a second time.
+//
+// Next to each decoded image sit its pyramid levels, each half the size
+// of the one before, and filtered views of those levels, tagged with the
+// Filters::Spec that made them, and the edge magnitude of those levels.
+// All of them share the budget.
+class ImageCache : public QObject {
+
+  Q_OBJECT
+
+  public :
+
+  ImageCache (qint64 budget, QObject * parent = nullptr) ;
+  ~ImageCache () ;
+
+  // scale and spec prepare the view too, at the level that scale picks
+  void prefetch (const QString & file, double scale = 1,
+    const Filters::Spec & spec = Filters::Spec ()) ;
+  // for views showing many images at once : queued behind every prefetch,
+  // at the level that fits the image in box screen pixels ; get () takes
+  // over a decode still queued rather than waiting for it
+  void prefetch_background (const QString & file, const QSizeF & box,
+    const Filters::Spec & spec = Filters::Spec ()) ;
+  // drops the background prefetches that have not started
+  void cancel_background () ;
+  // null when the file is neither cached nor being prefetched
+  QImage get (const QString & file) ;
+  void insert (const QString & file, const QImage & image) ;
+  bool ready (const QString & file) const ;
+  void clear () ;
+
+  // level n of base, built from the level above when missing
+  QImage level (const QString & file, const QImage & base, int n) ;
+  // level n of base with spec applied
+  QImage view (const QString & file, const QImage & base, int n, const Filters::Spec & spec) ;
+  // edge overlay of level n of base, from its cached magnitude
+  QImage edges (const QString & file, const QImage & base, int n, int threshold) ;
+  // level n with spec applied when it is cached, null otherwise ; never
+  // waits nor computes, for painting
+  QImage peek (const QString & file, int n, const Filters::Spec & spec = Filters::Spec ()) ;
+
+  qint64 bytes () const ;
+
+  // reads the whole file, then decodes it from memory
+  static QImage decode (const QString & file) ;
+
+  // deepest level that still has at least one pixel per screen pixel
+  static int level_for (const QSize & size, double scale) ;
+  // scale of an image of size fitted in box
+  static double fit_scale (const QSize & size, const QSizeF & box) ;
+
+  // called by the workers
+  void started (QRunnable * job) ;
+  void finished (const QString & file, const QImage & image) ;
+
+  signals :
+  // a prefetch is done with file, of size, the view it was asked for
+  // included ; emitted on the worker thread
+  void prepared (const QString & file, const QSize & size) ;
+
+  private :
+
+  struct Key {
+    QString file ;
+    int level ;
+    quint32 tag ;
+
+    bool operator == (const Key & other) const {
+      return level == other.level && tag == other.tag && file == other.file ;
+    }
+    friend uint qHash (const Key & key, uint seed = 0) {
+      return qHash (key.file, seed) ^ (uint (key.level) << 24) ^ key.tag ;
+    }
+  } ;
+
+  struct Entry {
+    QImage image ;
+    bool ready ;
+    quint64 stamp ;
+  } ;
+
+  void schedule (const QString & file, double scale, const QSizeF & box,
+    const Filters::Spec & spec, bool background) ;
+  // takes the queued background decode of file off the pool, with the
+  // mutex held
+  bool take_waiting (const QString & file) ;
+  QImage find (const Key & key) ;
+  void store (const Key & key, const QImage & image) ;
+  void trim (const Key & keep) ;
+
+  mutable QMutex mutex ;
+  QWaitCondition decoded ;
+  QHash<Key,Entry> entries ;
+  quint64 clock ;
+  qint64 used ;
+  qint64 budget ;
+
+  QThreadPool pool ;
+  // background jobs not started yet
+  QList<QRunnable *> waiting ;
+} ;
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <QImage>
+
+#include <functional>
+
+// Whole image pixel kernels behind the study views. Rows are split into
+// bands run on a shared pool, and the inner loops use the widest
+// instruction set the cpu offers at runtime : AVX2, SSE2, or plain C++.
+// All paths compute bit identical results.
+class Kernels {
+
+  public :
+
+  enum class Isa { scalar, sse2, avx2 } ;
+
+  // IMVIEW_ISA=scalar|sse2 caps the choice, for comparing the paths
+  static Isa isa () ;
+  static const char * isa_name (Isa isa) ;
+
+  // calls band (begin, end) over [0, rows), on the calling thread and
+  // the pool, and returns once every band is done ; bands hold at least
+  // grain rows
+  static void for_rows (int rows, const std::function<void(int,int)> & band, int grain = 32) ;
+
+  // Rec. 709 luma of 32 bit pixels, as Format_Grayscale8
+  static QImage luminance (const QImage & image) ;
+
+  // maps Grayscale8 values onto levels evenly spaced bands, 2 to 8
+  static QImage posterize (const QImage & gray, int levels) ;
+
+  // 2x2 box filter, the next pyramid level ; odd edges are dropped
+  static QImage halve (const QImage & image) ;
+
+  // three box passes each way, close to a gaussian with sigma about
+  // radius ; edges are extended, radius is capped at max_blur
+  static const int max_blur = 32 ;
+  static QImage box_blur (const QImage & image, int radius) ;
+
+  // Scharr gradient magnitude of the luma, Grayscale8, with values below
+  // threshold set to 0 ; a hard black to white step comes out at 255
+  static QImage edges (const QImage & image, int threshold) ;
+
+  // other drawn at offset over image : opaque per channel absolute
+  // differences where it covers image, transparent elsewhere
+  static QImage difference (const QImage & image, const QImage & other, const QPoint & offset) ;
+
+  // 32 bit pixels mirrored along the diagonal
+  static QImage transpose (const QImage & image) ;
+
+  struct Histograms {
+    quint32 luma [256] ;
+    quint32 red [256] ;
+    quint32 green [256] ;
+    quint32 blue [256] ;
+    quint64 pixels ;
+  } ;
+
+  // channel and luma counts of 32 bit pixels, partial counts per band
+  // merged at the end
+  static Histograms histograms (const QImage & image) ;
+
+  // image as one of the 32 bit formats the kernels read
+  static QImage to_32bit (const QImage & image) ;
+} ;
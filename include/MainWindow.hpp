@@ -1,10 +1,12 @@
 #pragma once
 
 #include "ContextTransformDialog.hpp"
+#include "ContextSwitcher.hpp"
 
 #include <QMainWindow>
 #include <QCheckBox>
 #include <QTimer>
+#include <QLabel>
 
 class MainWindow : public QMainWindow {
 
@@ -25,6 +27,11 @@ class MainWindow : public QMainWindow {
 
   QCheckBox * autosave ;
   ContextTransformDialog * ctxTransDialog ;
+  ContextSwitcher * ctxSwitcher ;
+
+  QLabel * perfLabel ;
+  QLabel * memLabel ;
+  QTimer * memTimer ;
 
   QCheckBox * back_n_forth ;
   QTimer * bnf1, * bnf2 ;
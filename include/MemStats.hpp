@@ -0,0 +1,62 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+#include <QImage>
+#include <QPixmap>
+
+#include <atomic>
+
+// Bytes held by imview, by category, with high-water marks. Owners set
+// the size of what they hold whenever it changes ; totals and peaks follow
+// with relaxed atomics, so any thread may update or read.
+class MemStats {
+
+  public :
+
+  enum Category {
+    pixels,      // decoded images shown by the views
+    mirrored,    // their mirrored copies
+    clipboard,   // last image copied
+    cache,       // decoded images held by the image cache
+    filenames,   // Context::images of every context
+    states,      // ImageState arrays and bitmaps of every context
+    sqlite,      // configured page cache of the backend, an upper bound
+    board,       // pixmaps drawn by the board
+    category_count
+  } ;
+
+  MemStats () ;
+
+  static const char * category_name (int category) ;
+
+  void set (Category category, qint64 bytes) ;
+  // for categories several owners share, each adding what it changed
+  void add (Category category, qint64 delta) ;
+  // peaks restart from the current values
+  void reset_peaks () ;
+
+  qint64 current (int category) const ;
+  qint64 peak (int category) const ;
+  qint64 total () const ;
+  qint64 total_peak () const ;
+
+  // resident set size of the process, -1 when unknown
+  static qint64 rss () ;
+
+  static qint64 bytes_of (const QImage & image) ;
+  static qint64 bytes_of (const QPixmap & pixmap) ;
+
+  QJsonObject to_json () const ;
+  // one line for the status bar
+  QString summary () const ;
+
+  private :
+
+  static void raise (std::atomic<qint64> & peak, qint64 value) ;
+
+  std::atomic<qint64> bytes[category_count] ;
+  std::atomic<qint64> peaks[category_count] ;
+  std::atomic<qint64> sum ;
+  std::atomic<qint64> sum_peak ;
+} ;
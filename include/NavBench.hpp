@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Application.hpp"
+
+#include <QDir>
+#include <QString>
+#include <QVector>
+#include <QJsonObject>
+
+// Replays a navigation sequence over a directory through the real
+// on_nextImage / on_prevImage / on_imgJump and context_refresh path, with a
+// GraphicsView on the offscreen platform, and reports switch latencies.
+class NavBench {
+
+  public :
+
+  enum class Op { next, prev, jump, jump_to, random } ;
+
+  struct Step {
+    Op op ;
+    int arg ;
+  } ;
+
+  NavBench (const QDir & dir) ;
+  ~NavBench () ;
+
+  // "next*100,prev*20,jump:7*10,goto:0,random*50"
+  bool parse (const QString & sequence) ;
+  QJsonObject run () ;
+
+  static QJsonObject summarize (QVector<qint64> samples_ns) ;
+
+  private :
+
+  QDir dir ;
+  QVector<Step> steps ;
+} ;
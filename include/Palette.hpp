@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QObject>
+#include <QImage>
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QColor>
+
+#include <atomic>
+
+// Dominant colours of an image : k-means over a small pyramid level, the
+// swatches sorted by the share of pixels they cover.
+class Palette {
+
+  public :
+
+  struct Swatch {
+    QRgb color ;
+    float share ;
+  } ;
+  typedef QVector<Swatch> Swatches ;
+
+  static const int colors = 6 ;
+
+  // empty when cancel gets set before it is done
+  static Swatches extract (const QImage & image, int k,
+    const std::atomic<bool> * cancel = nullptr) ;
+
+  // "#rrggbb@permille ..." as kept in the palette table
+  static QString to_text (const Swatches & swatches) ;
+  static Swatches from_text (const QString & text) ;
+} ;
+
+// Computes palettes on a worker thread and keeps them, in memory and in
+// the palette table, checked against the file's modification time.
+// request () emits ready () at once when it can, otherwise once the
+// worker is done ; work for an image the user left is cancelled, and
+// upcoming images are computed when nothing else waits.
+class PaletteService : public QObject {
+
+  Q_OBJECT
+
+  public :
+
+  PaletteService (QObject * parent = nullptr) ;
+  ~PaletteService () ;
+
+  // nothing is computed while disabled, the panel turns it on
+  bool enabled ;
+
+  // the image on show, cancels the others
+  void request (const QString & file) ;
+  void opportunistic (const QString & file) ;
+  bool lookup (const QString & file, Palette::Swatches & swatches) ;
+  void clear () ;
+
+  // called on the gui thread when a worker is done
+  void finished (const QString & file, qint64 mtime,
+    QSharedPointer<std::atomic<bool>> cancel, const Palette::Swatches & swatches) ;
+
+  signals :
+  void ready (const QString & file, const Palette::Swatches & swatches) ;
+
+  private :
+
+  void start (const QString & file, int priority) ;
+
+  QHash<QString,Palette::Swatches> palettes ;
+  QHash<QString,QSharedPointer<std::atomic<bool>>> running ;
+  QThreadPool pool ;
+} ;
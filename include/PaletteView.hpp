@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Application.hpp"
+#include "Palette.hpp"
+
+#include <QWidget>
+
+// the palette of the image on show, one band per swatch, its height
+// following the share ; a click copies the colour
+class PaletteView : public QWidget {
+
+  Q_OBJECT
+
+  public :
+
+  PaletteView (QWidget * parent = nullptr) ;
+  ~PaletteView () ;
+
+  virtual QSize sizeHint () const ;
+
+  protected :
+
+  virtual void paintEvent (QPaintEvent * evt) ;
+  virtual void mousePressEvent (QMouseEvent * evt) ;
+
+  private :
+
+  void image_changed () ;
+  void ready (const QString & file, const Palette::Swatches & swatches) ;
+  QVector<QRect> bands () const ;
+
+  QString file ;
+  Palette::Swatches swatches ;
+} ;
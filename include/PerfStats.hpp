@@ -0,0 +1,100 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QString>
+
+#include <atomic>
+
+// Latency histogram with 4 buckets per power of two of microseconds, from
+// 1 us to ~16 s. Recording is a couple of relaxed atomic increments, so any
+// thread can record or read while another one is recording.
+class Histogram {
+
+  public :
+
+  static const int buckets = 100 ;
+
+  Histogram () ;
+
+  void record (qint64 ns) ;
+  void reset () ;
+
+  quint64 count () const ;
+  qint64 mean () const ;
+  qint64 max () const ;
+  // upper bound of the bucket holding the q-th quantile, in nanoseconds
+  qint64 percentile (double q) const ;
+
+  QJsonObject to_json () const ;
+
+  static int bucket_of (qint64 ns) ;
+  static qint64 bucket_limit (int bucket) ;
+
+  private :
+
+  std::atomic<quint64> counts[buckets] ;
+  std::atomic<quint64> total ;
+  std::atomic<qint64> sum ;
+  std::atomic<qint64> maximum ;
+} ;
+
+// Breaks every image change down into stages and keeps a histogram per
+// stage. The gui thread drives a switch : begin () when navigation starts,
+// mark () as each stage ends, finish () once the new image is painted.
+// Stages a switch does not go through are folded into the next mark.
+class PerfStats {
+
+  public :
+
+  enum Stage {
+    event,    // input or timer event dispatch, up to the navigation call
+    step,     // step_image_index
+    state,    // state_refreshed, up to the view refresh
+    read,     // reading the file
+    decode,   // decoding it
+    upload,   // pixmap conversion
+    scene,    // items, transforms, and waiting for the paint event
+    paint,    // the first paint showing the new image
+    total,
+    stage_count
+  } ;
+
+  PerfStats () ;
+
+  static const char * stage_name (int stage) ;
+
+  // called for every input event, before it is delivered, and by the
+  // timers that navigate
+  void stamp_event () ;
+
+  void begin () ;
+  void mark (Stage stage) ;
+  // returns true if an image change completed and was recorded
+  bool finish () ;
+  void cancel () ;
+  bool active () const ;
+
+  void reset () ;
+
+  const Histogram & histogram (int stage) const ;
+  qint64 last (int stage) const ;
+  quint64 switches () const ;
+
+  QJsonObject to_json () const ;
+  // one line for the status bar
+  QString summary () const ;
+
+  private :
+
+  QElapsedTimer clock ;
+  qint64 event_start ;
+  qint64 start ;
+  qint64 previous ;
+  bool in_flight ;
+  bool refreshed ;
+
+  qint64 pending[stage_count] ;
+  qint64 last_ns[stage_count] ;
+  Histogram histograms[stage_count] ;
+} ;
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QtGlobal>
+
+// Pseudo random permutation of [0, size), defined by its seed alone : a
+// four round Feistel network over the smallest even bit width holding
+// size, cycle walked back into range. Nothing is stored per element, so a
+// shuffled context of any size persists as one integer, and both
+// directions are O(1) expected.
+class Permutation {
+
+  public :
+
+  Permutation () ;
+  Permutation (quint32 size, quint32 seed) ;
+
+  quint32 size () const ;
+  quint32 seed () const ;
+
+  // element at position, and position of element
+  quint32 at (quint32 position) const ;
+  quint32 position_of (quint32 element) const ;
+
+  private :
+
+  static const int rounds = 4 ;
+
+  quint32 encrypt (quint32 value) const ;
+  quint32 decrypt (quint32 value) const ;
+  quint32 round (quint32 half, int i) const ;
+
+  quint32 count ;
+  quint32 key ;
+  int half_bits ;
+  quint32 half_mask ;
+  quint32 keys[rounds] ;
+} ;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "PerfStats.hpp"
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Timed practice : moves on with on_nextImage every interval. Deadlines
+// are absolute (start + k * interval), so lateness never accumulates, and
+// the image shown at the next deadline is prefetched into the image cache
+// right after each transition, so a transition costs no decode.
+class PracticeTimer : public QObject {
+
+  Q_OBJECT
+
+  public :
+
+  PracticeTimer (QObject * parent = nullptr) ;
+  ~PracticeTimer () ;
+
+  void start (int seconds) ;
+  void stop () ;
+  bool active () const ;
+  int interval () const ;
+  qint64 remaining_ms () const ;
+
+  // how late transitions were against their schedule
+  const Histogram & jitter () const ;
+
+  signals :
+
+  void transition (int index, qint64 late_ns) ;
+  void stopped () ;
+
+  private :
+
+  void on_deadline () ;
+  void arm () ;
+  void prefetch_upcoming () ;
+
+  QTimer * timer ;
+  QElapsedTimer clock ;
+  qint64 interval_ns ;
+  qint64 deadline_ns ;
+  int transitions ;
+  Histogram lateness ;
+} ;
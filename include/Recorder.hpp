@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+#include <QJsonObject>
+
+// Records calls to the Application entry points into a compact binary
+// file : per call one op byte, the time since the previous call in
+// microseconds, and the arguments the op takes as 32 bit floats. Only the
+// outermost entry point is kept, calls it makes itself replay on their own.
+class Recorder {
+
+  public :
+
+  enum class Op : quint8 {
+    open_dir, select_dir, close_dir,
+    move_grab, move_ungrab, scale_grab, scale_ungrab, drag, push_translate,
+    rotation, discrete_rotation, zoom, mirror_toggle,
+    next_image, prev_image, jump, jump_specific, step_mode,
+    context_rot_mirror, transform_others, resize, save,
+    shuffle,  // a : high half of the seed or -1 when off, b : low half
+    value_filter, blur, edges,
+    compare_open, compare_opacity, compare_difference, compare_offset,
+    board  // a : on, path : the image indices shown, space separated
+  } ;
+
+  struct Event {
+    qint64 time_us ;   // since the start of the recording
+    Op op ;
+    double a ;
+    double b ;
+    QString path ;
+  } ;
+
+  Recorder () ;
+  ~Recorder () ;
+
+  bool open (const QString & file) ;
+  void close () ;
+
+  void record (Op op, double a, double b, const QString & path) ;
+
+  static bool load (const QString & file, QVector<Event> & events) ;
+  static const char * op_name (Op op) ;
+
+  // counts nesting so that only the outermost entry point is written
+  class Scope {
+    public :
+    Scope (Recorder * recorder, Op op, double a = 0, double b = 0,
+      const QString & path = QString ()) ;
+    ~Scope () ;
+
+    private :
+    Recorder * recorder ;
+  } ;
+
+  private :
+
+  static int args_of (Op op) ;
+  static bool has_path (Op op) ;
+
+  QFile file ;
+  QDataStream out ;
+  QElapsedTimer clock ;
+  qint64 last_us ;
+  int depth ;
+} ;
+
+// Drives a recorded session through the same entry points, with a view
+// on the offscreen platform, and reports per call frame times and the
+// time of every flush to the database.
+class Replayer {
+
+  public :
+
+  Replayer (const QVector<Recorder::Event> & events) ;
+  ~Replayer () ;
+
+  // realtime waits out the recorded gaps, otherwise calls run back to back
+  QJsonObject run (bool realtime) ;
+
+  private :
+
+  bool dispatch (const Recorder::Event & event) ;
+
+  QVector<Recorder::Event> events ;
+} ;
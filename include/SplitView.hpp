@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Application.hpp"
+
+#include <QSplitter>
+#include <QVector>
+
+class GraphicsView ;
+
+// Views side by side, each with its own image and transform. The one
+// with focus is the active view : it follows the current context and
+// takes every command, the others keep what they showed when they were
+// left. Coming back to a view restores its context, image and transform.
+// All of them draw from app->cache, so showing a file twice decodes it
+// once.
+class SplitView : public QSplitter {
+
+  Q_OBJECT
+
+  public :
+
+  SplitView (QWidget * parent = nullptr) ;
+  ~SplitView () ;
+
+  // the new view starts on the current image and becomes active
+  GraphicsView * add_view () ;
+  // closes the active view, the last one stays
+  void remove_view () ;
+
+  GraphicsView * active () const ;
+  QVector<GraphicsView *> views () const ;
+
+  void activate (GraphicsView * view) ;
+
+  signals :
+  void view_added (GraphicsView * view) ;
+
+  private :
+
+  struct Pane {
+    GraphicsView * view ;
+    // where the view was left, context is null until then
+    Application::Context::Ptr context ;
+    int index ;
+    Application::ImageState state ;
+  } ;
+
+  Pane * pane_of (GraphicsView * view) ;
+  // decodes ahead for the views that are not active
+  void prefetch_others () ;
+
+  QVector<Pane> panes ;
+} ;
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+
+// Scoped spans for Chrome / Perfetto traces. Every thread writes into its
+// own ring buffer, so recording takes no lock ; when tracing is off a span
+// costs one relaxed load. dump () writes the trace event JSON that
+// chrome://tracing and ui.perfetto.dev open.
+//
+//   void Application::flush_to_db () {
+//     TRACE_SCOPE ("flush_to_db") ;
+//
+// Span names are not copied, they must be string literals.
+class Trace {
+
+  public :
+
+  // spans kept per thread, older ones are overwritten
+  static const int capacity = 1 << 16 ;
+
+  static void enable () ;
+  static void disable () ;
+  static bool enabled () { return on.load (std::memory_order_relaxed) ; }
+
+  // nanoseconds since tracing was first enabled
+  static qint64 now () ;
+  static void record (const char * name, qint64 start, qint64 end) ;
+
+  static bool dump (const QString & file) ;
+
+  class Scope {
+    public :
+    explicit Scope (const char * name)
+      : name (name), start (enabled () ? now () : -1) { }
+    ~Scope () { if (start >= 0) { record (name, start, now ()) ; } }
+
+    Scope (const Scope &) = delete ;
+    Scope & operator = (const Scope &) = delete ;
+
+    private :
+    const char * name ;
+    qint64 start ;
+  } ;
+
+  private :
+
+  static std::atomic<bool> on ;
+} ;
+
+#define TRACE_CONCAT_(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT (trace_scope_, __LINE__) (name)
@@ -1,11 +1,26 @@
 #include "Application.hpp"
+#include "CommandProcessor.hpp"
+#include "ControlServer.hpp"
+#include "Exporter.hpp"
+#include "NavBench.hpp"
+#include "Recorder.hpp"
+#include "ImageCache.hpp"
+#include "Palette.hpp"
+#include "PracticeTimer.hpp"
+#include "Trace.hpp"
 
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSqlError>
 #include <QSetIterator>
+#include <QPair>
+#include <QVersionNumber>
+#include <QStringList>
+#include <QJsonDocument>
+#include <QFile>
 #include <QTimer>
-#include <QSocketNotifier>
+#include <QScopedPointer>
+#include <QTemporaryDir>
 
 #include <QtMath>
 #include <cmath>
@@ -17,8 +32,6 @@
 using std::cerr ;
 using std::endl ;
 using std::fmod ;
-using std::cin ;
-using std::string ;
 
 std::ostream& operator << (std::ostream & out, const QPoint & x) {
   out << "(" << x.x () << ", " << x.y () << ")" ;
@@ -40,12 +53,32 @@ std::ostream& operator << (std::ostream & out, const Application::ImageState& st
   return out ;
 }
 
-Application::~Application () { }
+Application::~Application () {
+  // its workers read the cache, which as an earlier child goes first
+  delete palettes ;
+  palettes = nullptr ;
+  // a decode still running stores through app->mem, gone once the
+  // children are deleted
+  delete cache ;
+  cache = nullptr ;
+}
 
 //void dbg () ;
 
 Application::Application (int & argc, char ** &argv) 
   : QApplication (argc, argv)
+  , current_state (nullptr)
+  , commands (nullptr)
+  , recorder (nullptr)
+  , cache (nullptr)
+  , practice (nullptr)
+  , active_view (nullptr)
+  , state_override { QUuid (), -1, ImageState () }
+  , edge_threshold (0)
+  , compare { QString (), 50, false, 0, 0 }
+  , board (false)
+  , batch_depth (0)
+  , batch_img_changed (false)
   , move_grabbed (false)
   , scale_grabbed (false)
   , grab_x (0)
@@ -57,18 +90,60 @@ Application::Application (int & argc, char ** &argv)
   setOrganizationName ("rks_home") ;
   setOrganizationDomain ("art.rks.ravi039.net") ;
 
-  auto sn = new QSocketNotifier (fileno (stdin), QSocketNotifier::Read, this) ;
+  cmdline.setApplicationDescription (
+    "A personal image viewer, geared towards digital painting practice.") ;
+  cmdline.addHelpOption () ;
+  cmdline.addPositionalArgument ("database", "sqlite backend file") ;
+  cmdline.addOption ({ "control",
+    "Accept control clients on local socket <name> (or $IMVIEW_CONTROL).",
+    "name" }) ;
+  cmdline.addOption ({ "export",
+    "Render every image of <context> (id, id prefix, current or all) with "
+    "its saved transform, then exit.", "context" }) ;
+  cmdline.addOption ({ "out", "Export into <dir>.", "dir", "." }) ;
+  cmdline.addOption ({ "format", "Export file <format>.", "format", "png" }) ;
+  cmdline.addOption ({ "size",
+    "Frame exports like the view, in a <WxH> canvas, instead of cropping.",
+    "WxH" }) ;
+  cmdline.addOption ({ "jobs", "Use <n> worker threads.", "n" }) ;
+  cmdline.addOption ({ "bench-nav",
+    "Replay a navigation sequence over <dir> offscreen, report switch "
+    "latencies, then exit.", "dir" }) ;
+  cmdline.addOption ({ "sequence",
+    "Benchmark <steps>, e.g. next*100,prev*20,jump:7*10,goto:0,random*50.",
+    "steps", "next*100,prev*100,jump:7*50,random*50" }) ;
+  cmdline.addOption ({ "json",
+    "Write the machine readable report to <file> instead of stdout.",
+    "file" }) ;
+  cmdline.addOption ({ "record",
+    "Record the session's navigation and transform calls into <file>.",
+    "file" }) ;
+  cmdline.addOption ({ "replay",
+    "Replay a recorded session offscreen, report frame and flush times, "
+    "then exit.", "file" }) ;
+  cmdline.addOption ({ "speed",
+    "Replay at <speed> : max, or recorded to keep the recorded pauses.",
+    "speed", "max" }) ;
+  cmdline.addOption ({ "trace",
+    "Record spans of the hot paths and write them as a Chrome trace to "
+    "<file> on exit (or $IMVIEW_TRACE).", "file" }) ;
+  cmdline.process (*this) ;
+
+  trace_file = cmdline.value ("trace") ;
+  if (trace_file.isEmpty ()) {
+    trace_file = qEnvironmentVariable ("IMVIEW_TRACE") ;
+  }
+  if (! trace_file.isEmpty ()) { Trace::enable () ; }
 
-  connect (sn, &QSocketNotifier::activated,
-      [this, sn] (int fd) {
-        string line ;
-        if (cin.eof () or cin.fail ()) {
-          sn->setEnabled (false) ;
-          return ;
-        }
-        std::getline (cin, line) ;
-        emit cmdline (QString::fromStdString (line)) ;
-      }) ;
+  commands = new CommandProcessor (this) ;
+  cache = new ImageCache (384 << 20, this) ;
+  practice = new PracticeTimer (this) ;
+  palettes = new PaletteService (this) ;
+
+  installEventFilter (this) ;
+
+  connect (this, &Application::current_img_changed,
+    this, &Application::context_changed) ;
 
   //dbg () ;
 }
@@ -117,6 +192,12 @@ Application::Context::Context ()
   : id (QUuid::createUuid ()) 
   , current_image_index (0)
   , stepMode (Application::StepMode::sm_Normal)
+  , generation (0)
+  , rot_gen (0)
+  , mirror_gen (0)
+  , place_gen (0)
+  , shuffled (false)
+  , persisted (false)
 { }
 
 Application::Context::Context (
@@ -128,7 +209,13 @@ Application::Context::Context (
   id (id),
   dir (dir),
   current_image_index (current_image_index),
-  stepMode (stepMode)
+  stepMode (stepMode),
+  generation (0),
+  rot_gen (0),
+  mirror_gen (0),
+  place_gen (0),
+  shuffled (false),
+  persisted (false)
 { }
 
 bool Application::Context::operator == (const Application::Context & other) {
@@ -136,20 +223,82 @@ bool Application::Context::operator == (const Application::Context & other) {
 }
 
 bool Application::Context::step_image_index (int step) {
+  if (images.size () == 0) { return false ; }
+  current_image_index = upcoming_index (step) ;
+  return true ;
+}
+
+int Application::Context::upcoming_index (int step) const {
+  return upcoming_index (current_image_index, step) ;
+}
+
+int Application::Context::upcoming_index (int from, int step) const {
   auto size = images.size () ;
-  auto & current = current_image_index ;
+  if (size == 0) { return -1 ; }
 
-  if (size == 0) { return false ; }
-  else {
-    current += step ;
-    if (current >= size) {
-      current = current % size ;
-    } else if (current < 0) {
-      current = (size - ((- current) % size)) % size ;
-    }
+  auto wrap = [size] (qint64 i) {
+    i %= size ;
+    return static_cast<int> (i < 0 ? i + size : i) ;
+  } ;
+
+  if (! shuffled) { return wrap (qint64 (from) + step) ; }
+
+  auto position = order.position_of (from) ;
+  return order.at (wrap (qint64 (position) + step)) ;
+}
+
+void Application::Context::reset_states () {
+  auto size = images.size () ;
+  states.fill (ImageState (), size) ;
+  stateful.fill (false, size) ;
+  state_gens.fill (0, size) ;
+  dirty_states.fill (false, size) ;
+  persisted_states.fill (false, size) ;
+  order = Permutation (size, order.seed ()) ;
+}
+
+bool Application::Context::has_state (int index) const {
+  return index >= 0 && index < stateful.size () && stateful.testBit (index) ;
+}
+
+Application::ImageState * Application::Context::state (int index) {
+  if (index < 0 || index >= states.size ()) { return nullptr ; }
+
+  auto & state = states[index] ;
+  if (! has_state (index) || state_gens.at (index) < generation) {
+    state = effective_state (index) ;
+    state_gens[index] = generation ;
+    stateful.setBit (index) ;
   }
 
-  return true ;
+  return &state ;
+}
+
+qint64 Application::Context::state_bytes () const {
+  qint64 bits = stateful.size () + dirty_states.size () + persisted_states.size () ;
+  return states.capacity () * static_cast<qint64> (sizeof (ImageState))
+    + state_gens.capacity () * static_cast<qint64> (sizeof (int))
+    + bits / 8 ;
+}
+
+Application::ImageState Application::Context::effective_state (int index) const {
+  ImageState state ;
+  int gen = 0 ;
+  if (has_state (index)) {
+    state = states.at (index) ;
+    gen = state_gens.at (index) ;
+  }
+
+  if (rot_gen > gen) { state.rot = base.rot ; }
+  if (mirror_gen > gen) { state.mirrored = base.mirrored ; }
+  if (place_gen > gen) {
+    state.x = base.x ;
+    state.y = base.y ;
+    state.z = base.z ;
+    state.pristine = base.pristine ;
+  }
+
+  return state ;
 }
 
 Application::ImageState::~ImageState () { }
@@ -168,7 +317,69 @@ Application::ImageState::ImageState (
 
 double Application::ImageState::scale () const { return 1.0f/z ; }
 
+Application::Context::Ptr Application::find_context (const QUuid & id) const {
+  return contexts_by_id.value (id) ;
+}
+
+Application::Context::Ptr Application::match_context (const QString & text) const {
+  if (text == "current") { return current_context ; }
+
+  auto ctx = find_context (QUuid (text)) ;
+  if (! ctx && ! text.isEmpty ()) {
+    for (auto candidate : all_contexts) {
+      if (candidate->id.toString ().mid (1).startsWith (text)) {
+        return candidate ;
+      }
+    }
+  }
+
+  return ctx ;
+}
+
+void Application::add_context (Context::Ptr ctx) {
+  all_contexts.push_back (ctx) ;
+  contexts_by_id.insert (ctx->id, ctx) ;
+  account_contexts () ;
+}
+
+void Application::remove_context (Context::Ptr ctx) {
+  // stays linear, as erasing from the ordered list would be with an index
+  // too : closing a context is rare, and account_contexts walks them all
+  all_contexts.removeOne (ctx) ;
+  contexts_by_id.remove (ctx->id) ;
+  account_contexts () ;
+}
+
+void Application::account_contexts () {
+  qint64 names = 0, states = 0 ;
+  for (const auto & ctx : all_contexts) {
+    names += ctx->images.bytes () ;
+    states += ctx->state_bytes () ;
+  }
+  mem.set (MemStats::filenames, names) ;
+  mem.set (MemStats::states, states) ;
+}
+
+bool Application::eventFilter (QObject * watched, QEvent * evt) {
+  switch (evt->type ()) {
+    case QEvent::ShortcutOverride :
+    case QEvent::KeyPress :
+    case QEvent::MouseButtonPress :
+    case QEvent::MouseButtonRelease :
+    // not timers : cursor blinks, animations and the like would overwrite
+    // the stamp, the navigation timers stamp in their own slots
+    case QEvent::SockAct :
+      perf.stamp_event () ;
+      break ;
+    default :
+      break ;
+  }
+  return QApplication::eventFilter (watched, evt) ;
+}
+
 void Application::dir_selected (const QDir & dir) {
+  Recorder::Scope rec (recorder, Recorder::Op::open_dir, 0, 0, dir.absolutePath ()) ;
+  TRACE_SCOPE ("dir_selected") ;
 
   auto new_context = Context::Ptr::create () ;
 
@@ -184,14 +395,15 @@ void Application::dir_selected (const QDir & dir) {
   for (auto iter = entries.constBegin () ; iter != entries.constEnd () ; iter++) {
     new_context->images << (*iter) ;
   }
+  new_context->reset_states () ;
 
-  all_contexts.push_back (new_context) ;
+  add_context (new_context) ;
   current_context = new_context ;
   context_is_dirty () ;
 
   state_refreshed (true) ;
 
-  emit all_contexts_changed (all_contexts) ;
+  emit context_added (new_context) ;
   emit current_context_changed (current_context) ;
 
   state_refreshed () ;
@@ -200,10 +412,18 @@ void Application::dir_selected (const QDir & dir) {
 void Application::on_startup () {
   state_refreshed (true) ;
 
-  emit all_contexts_changed (all_contexts) ;
+  emit contexts_reset () ;
   emit current_context_changed (current_context) ;
 
   state_refreshed () ;
+
+  // where the recording starts from, states come from the backend though
+  if (recorder && current_context) {
+    typedef Recorder::Op Op ;
+    recorder->record (Op::select_dir, 0, 0, current_context->dir.absolutePath ()) ;
+    recorder->record (Op::step_mode, stepmode_to_int (current_context->stepMode), 0, QString ()) ;
+    recorder->record (Op::jump_specific, current_context->current_image_index, 0, QString ()) ;
+  }
 }
 
 void Application::state_refreshed (bool just_update_state) {
@@ -213,20 +433,19 @@ void Application::state_refreshed (bool just_update_state) {
     return ;
   }
 
+  // the view still shows the previous image until the batch ends
+  if (batch_img_changed) { just_update_state = true ; }
+
   auto index = current_context->current_image_index ;
   const auto & images = current_context->images ;
 
   if (index < images.size () && index >= 0) {
-    ImageState::Ptr state ;
-    auto & states = current_context->states ;
-
-    if (states.contains (index)) {
-      state = states[index] ;
+    auto state = current_context->state (index) ;
+    if (state_override.index == index && state_override.context == current_context->id) {
+      state = &state_override.state ;
     } else {
-      state = ImageState::Ptr::create () ;
-      states[index] = state ;
+      state_override.index = -1 ;
     }
-
     current_state = state ;
 
     if (! just_update_state) {
@@ -240,16 +459,20 @@ void Application::state_refreshed (bool just_update_state) {
       emit img_mirror (state->mirrored) ;
     }
 
+  } else {
+    current_state = nullptr ;
   }
 }
 
 void Application::move_grab (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::move_grab, x, y) ;
   x1 = grab_x = x ;
   y1 = grab_y = y ;
   move_grabbed = true ;
 }
 
 void Application::move_ungrab (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::move_ungrab, x, y) ;
   move_grabbed = false ;
   state_is_dirty () ;
 }
@@ -259,12 +482,14 @@ void Application::show_status_bar_msg(const QString &msg) {
 }
 
 void Application::scale_grab (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::scale_grab, x, y) ;
   x1 = grab_x = x ; 
   y1 = grab_y = y ;
   scale_grabbed = true ;
 }
 
 void Application::scale_ungrab (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::scale_ungrab, x, y) ;
   scale_grabbed = false ;
   state_is_dirty () ;
 }
@@ -279,6 +504,7 @@ void Application::save_xy (double x, double y) {
 }
 
 void Application::on_resize () {
+  Recorder::Scope rec (recorder, Recorder::Op::resize) ;
   emit resized () ;
 }
 
@@ -305,7 +531,7 @@ bool close_to_mode_angle (double angle, Application::StepMode mode) {
   return x == 0 ;
 }
 
-bool nextAngle (double & angle, Application::StepMode mode, bool backwards = false) {
+bool nextAngle (double & angle, Application::StepMode mode, bool backwards) {
   typedef Application::StepMode SM ;
 
   if (mode == SM::sm_Normal) { return false ; }
@@ -333,8 +559,10 @@ bool nextAngle (double & angle, Application::StepMode mode, bool backwards = fal
 }
 
 void Application::on_nextImage () {
+  Recorder::Scope rec (recorder, Recorder::Op::next_image) ;
   typedef Application::StepMode SM ;
-  if (current_context) {
+  perf.begin () ;
+  if (current_context && current_state) {
     auto mode = current_context->stepMode ;
 
     if (current_state && mode != SM::sm_Normal) {
@@ -350,8 +578,9 @@ void Application::on_nextImage () {
       emit img_rotate (current_state->rot) ;
       emit img_mirror (current_state->mirrored) ;
     } else if (current_context->step_image_index (1)) {
+      perf.mark (PerfStats::step) ;
       state_refreshed (true) ;
-      emit current_img_changed (current_context) ;
+      notify_img_changed () ;
       //dump_cur_state () ;
       state_refreshed () ;
       state_is_dirty () ;
@@ -361,8 +590,10 @@ void Application::on_nextImage () {
 }
 
 void Application::on_prevImage () {
+  Recorder::Scope rec (recorder, Recorder::Op::prev_image) ;
   typedef Application::StepMode SM ;
-  if (current_context) {
+  perf.begin () ;
+  if (current_context && current_state) {
     auto mode = current_context->stepMode ;
 
     if (current_state && mode != SM::sm_Normal) {
@@ -378,13 +609,14 @@ void Application::on_prevImage () {
       emit img_rotate (current_state->rot) ;
       emit img_mirror (current_state->mirrored) ;
     } else if (current_context->step_image_index (-1)) {
+      perf.mark (PerfStats::step) ;
       state_refreshed (true) ;
       if (mode != SM::sm_Normal) {
         current_state->rot = 359.0f ;
         nextAngle (current_state->rot, mode, true) ;
         current_state->mirrored = true ;
       }
-      emit current_img_changed (current_context) ;
+      notify_img_changed () ;
       //dump_cur_state () ;
       state_refreshed () ;
       state_is_dirty () ;
@@ -394,19 +626,24 @@ void Application::on_prevImage () {
 }
 
 void Application::on_stepModeChange (Application::StepMode mode) {
+  Recorder::Scope rec (recorder, Recorder::Op::step_mode, stepmode_to_int (mode)) ;
   if (current_context) {
     if (current_context->stepMode != mode) {
       current_context->stepMode = mode ;
       context_is_dirty () ;
+      emit context_changed (current_context) ;
     }
   }
 }
 
 void Application::on_imgJump (int steps) {
+  Recorder::Scope rec (recorder, Recorder::Op::jump, steps) ;
+  perf.begin () ;
   if (current_context) {
     if (current_context->step_image_index (steps)) {
+      perf.mark (PerfStats::step) ;
       state_refreshed (true) ;
-      emit current_img_changed (current_context) ;
+      notify_img_changed () ;
       state_refreshed () ;
       state_is_dirty () ;
       return ;
@@ -423,6 +660,8 @@ int Application::num_images () {
 }
 
 void Application::on_imgJumpSpecific (int target) {
+  Recorder::Scope rec (recorder, Recorder::Op::jump_specific, target) ;
+  perf.begin () ;
   if (current_context) {
     int old_index = current_context->current_image_index ;
     int new_index = target ;
@@ -433,8 +672,9 @@ void Application::on_imgJumpSpecific (int target) {
 
     if (new_index != old_index and new_index >= 0) {
       current_context->current_image_index = new_index ;
+      perf.mark (PerfStats::step) ;
       state_refreshed (true) ;
-      emit current_img_changed (current_context) ;
+      notify_img_changed () ;
       state_refreshed () ;
       state_is_dirty () ;
       return ;
@@ -443,6 +683,7 @@ void Application::on_imgJumpSpecific (int target) {
 }
 
 void Application::on_mirrorToggle () {
+  Recorder::Scope rec (recorder, Recorder::Op::mirror_toggle) ;
   if (current_state) {
     bool & val = current_state->mirrored ;
     val = !val ;
@@ -452,6 +693,7 @@ void Application::on_mirrorToggle () {
 }
 
 void Application::on_rotation (double value) {
+  Recorder::Scope rec (recorder, Recorder::Op::rotation, value) ;
   if (current_state) {
     current_state->rot = value ;
     emit img_rotate (value) ;
@@ -459,11 +701,25 @@ void Application::on_rotation (double value) {
   }
 }
 
+void Application::on_zoom (double z) {
+  Recorder::Scope rec (recorder, Recorder::Op::zoom, z) ;
+  if (current_state) {
+    if (z < 0.05) { z = 0.05 ; }
+    else if (z > 20) { z = 20 ; }
+    current_state->z = z ;
+    emit img_scale (current_state->scale ()) ;
+    state_is_dirty () ;
+  }
+}
+
 void Application::on_discrete_rotation () {
+  Recorder::Scope rec (recorder, Recorder::Op::discrete_rotation) ;
   state_is_dirty () ;
 }
 
 void Application::drag (double x2, double y2) {
+  Recorder::Scope rec (recorder, Recorder::Op::drag, x2, y2) ;
+  TRACE_SCOPE ("drag") ;
   if (current_state) {
 
     if (move_grabbed) {
@@ -490,6 +746,7 @@ void Application::drag (double x2, double y2) {
 }
 
 void Application::push_translate (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::push_translate, x, y) ;
   if (current_state) {
     if ( (not move_grabbed) and (not scale_grabbed)) {
       emit img_translate (x, y) ;
@@ -498,13 +755,9 @@ void Application::push_translate (double x, double y) {
 }
 
 void Application::on_context_selection (QUuid id) {
-  Context::Ptr target = nullptr ;
-  for (int i = 0 ; i < all_contexts.size () ; i++) {
-    if (all_contexts.at (i)->id == id) {
-      target = all_contexts.at (i) ;
-      break ;
-    }
-  }
+  auto target = find_context (id) ;
+  Recorder::Scope rec (recorder, Recorder::Op::select_dir, 0, 0,
+    target ? target->dir.absolutePath () : QString ()) ;
 
   if (target) {
     current_context = target ;
@@ -512,30 +765,26 @@ void Application::on_context_selection (QUuid id) {
 
   state_refreshed (true) ;
 
-  emit all_contexts_changed (all_contexts) ;
   emit current_context_changed (current_context) ;
 
   state_refreshed () ;
 }
 
 void Application::on_context_deletion (QUuid id) {
-  Context::Ptr target = nullptr ;
-  int t_i = 0 ;
-  for (int i = 0 ; i < all_contexts.size () ; i++) {
-    if (all_contexts.at (i)->id == id) {
-      target = all_contexts.at (i) ;
-      t_i = i ;
-      break ;
-    }
-  }
+  auto target = find_context (id) ;
+  Recorder::Scope rec (recorder, Recorder::Op::close_dir, 0, 0,
+    target ? target->dir.absolutePath () : QString ()) ;
 
   if (! target or ! current_context) { return ; }
 
   auto target_id = target->id ;
   auto current_id = current_context->id ;
 
-  deleted_contexts.insert (all_contexts.at (t_i)->id) ;
-  all_contexts.removeAt (t_i) ;
+  deleted_contexts.insert (target_id) ;
+  dirty_contexts.remove (target_id) ;
+  remove_context (target) ;
+
+  emit context_removed (target_id) ;
 
   if (target_id == current_id) {
     if (all_contexts.size () > 0) {
@@ -543,7 +792,6 @@ void Application::on_context_deletion (QUuid id) {
 
       state_refreshed (true) ;
 
-      emit all_contexts_changed (all_contexts) ;
       emit current_context_changed (current_context) ;
 
       state_refreshed () ;
@@ -551,70 +799,194 @@ void Application::on_context_deletion (QUuid id) {
       current_context = nullptr ;
       current_state = nullptr ;
 
-      emit all_contexts_changed (all_contexts) ;
       emit current_context_changed (current_context) ;
     }
-
-  } else {
-    emit all_contexts_changed (all_contexts) ;
   }
-  
 }
 
 void Application::on_context_wide_rot_mirror (double rot, bool mirror) {
+  Recorder::Scope rec (recorder, Recorder::Op::context_rot_mirror, rot, mirror ? 1 : 0) ;
   if (current_context) {
     auto ctx = current_context ;
-    for (int i = 0 ; i < ctx->images.size () ; i++) {
-      ImageState::Ptr state ;
-      if (ctx->states.contains (i)) {
-        state = ctx->states[i] ;
-      } else {
-        state = ImageState::Ptr::create () ;
-        ctx->states[i] = state ;
-      }
-
-      state->rot = rot ;
-      state->mirrored = mirror ;
 
-      state_is_dirty (i) ;
-    }
+    ctx->base.rot = rot ;
+    ctx->base.mirrored = mirror ;
+    ctx->generation++ ;
+    ctx->rot_gen = ctx->generation ;
+    ctx->mirror_gen = ctx->generation ;
+    context_is_dirty (ctx) ;
 
     state_refreshed () ;
   }
 }
 
 void Application::on_transform_others () {
+  Recorder::Scope rec (recorder, Recorder::Op::transform_others) ;
   if (current_context) {
     auto ctx = current_context ;
 
     auto cur_index = ctx->current_image_index ;
-    ImageState::Ptr cur_state ;
-    if (ctx->states.contains (cur_index)) {
-      cur_state = ctx->states[cur_index] ;
-    } else {
-      cur_state = ImageState::Ptr::create () ;
-    }
+    if (cur_index < 0 || cur_index >= ctx->states.size ()) { return ; }
+    const auto cur_state = ctx->effective_state (cur_index) ;
+
+    // setup base.rot, base.x, etc
+    ctx->base.x = cur_state.x ;
+    ctx->base.y = cur_state.y ;
+    ctx->base.z = cur_state.z ;
+    ctx->base.rot = cur_state.rot ;
+    ctx->base.pristine = false ;
+    ctx->generation++ ;
+    ctx->rot_gen = ctx->generation ;
+    ctx->place_gen = ctx->generation ;
+    context_is_dirty (ctx) ;
 
-    for (int i = 0 ; i < ctx->images.size () ; i++) {
-      ImageState::Ptr state ;
-      if (ctx->states.contains (i)) {
-        state = ctx->states[i] ;
-      } else {
-        state = ImageState::Ptr::create () ;
-        ctx->states[i] = state ;
-      }
+    state_refreshed () ;
+  }
+}
 
-      // setup state->rot, state->mirrored, etc
-      state->x = cur_state->x ;
-      state->y = cur_state->y ;
-      state->z = cur_state->z ;
-      state->rot = cur_state->rot ;
-      state->pristine = false ;
+void Application::begin_batch () {
+  batch_depth++ ;
+}
 
-      state_is_dirty (i) ;
-    }
+void Application::end_batch () {
+  if (batch_depth > 0) { batch_depth-- ; }
+  if (batch_depth == 0) { sync_batch () ; }
+}
 
+void Application::sync_batch () {
+  if (batch_img_changed) {
+    batch_img_changed = false ;
+    emit current_img_changed (current_context) ;
     state_refreshed () ;
+    prefetch_upcoming () ;
+  }
+}
+
+void Application::notify_img_changed () {
+  perf.mark (PerfStats::state) ;
+  if (batch_depth > 0) {
+    batch_img_changed = true ;
+  } else {
+    emit current_img_changed (current_context) ;
+    prefetch_upcoming () ;
+  }
+}
+
+void Application::prefetch_upcoming () {
+  auto ctx = current_context ;
+  if (! ctx) { return ; }
+
+  // follows the shuffle order, so random navigation hits the cache too
+  auto next = ctx->upcoming_index (1) ;
+  if (next >= 0 && next != ctx->current_image_index) {
+    cache->prefetch (ctx->dir.absoluteFilePath (ctx->images.at (next)),
+      ctx->effective_state (next).scale (), view_filter) ;
+  }
+}
+
+void Application::request_palette () {
+  auto ctx = current_context ;
+  if (! palettes->enabled || ! ctx || ctx->images.size () == 0) { return ; }
+
+  palettes->request (ctx->dir.absoluteFilePath (ctx->images.at (ctx->current_image_index))) ;
+  auto next = ctx->upcoming_index (1) ;
+  if (next != ctx->current_image_index) {
+    palettes->opportunistic (ctx->dir.absoluteFilePath (ctx->images.at (next))) ;
+  }
+}
+
+void Application::on_value_filter (int value) {
+  Recorder::Scope rec (recorder, Recorder::Op::value_filter, value) ;
+  if (value < 0 || value >= Filters::value_count) { return ; }
+
+  view_filter.value = static_cast<Filters::Value> (value) ;
+  emit view_filter_changed () ;
+  prefetch_upcoming () ;
+}
+
+void Application::on_blur (int radius, bool settled) {
+  Recorder::Scope rec (recorder, Recorder::Op::blur, radius) ;
+  radius = qBound (0, radius, Filters::max_blur) ;
+  if (radius == view_filter.blur) { return ; }
+
+  view_filter.blur = radius ;
+  emit view_filter_changed () ;
+  // each radius is a separate view, only the one kept is worth preparing
+  if (settled) { prefetch_upcoming () ; }
+}
+
+void Application::on_edges (int threshold) {
+  Recorder::Scope rec (recorder, Recorder::Op::edges, threshold) ;
+  threshold = qBound (0, threshold, 255) ;
+  if (threshold == edge_threshold) { return ; }
+
+  edge_threshold = threshold ;
+  emit edges_changed () ;
+}
+
+void Application::on_compare_open (const QString & file) {
+  Recorder::Scope rec (recorder, Recorder::Op::compare_open, 0, 0, file) ;
+  compare.file = file ;
+  compare.x = compare.y = 0 ;
+  emit compare_changed () ;
+}
+
+void Application::on_compare_opacity (int percent) {
+  Recorder::Scope rec (recorder, Recorder::Op::compare_opacity, percent) ;
+  percent = qBound (0, percent, 100) ;
+  if (percent == compare.opacity) { return ; }
+
+  compare.opacity = percent ;
+  emit compare_changed () ;
+}
+
+void Application::on_compare_difference (bool on) {
+  Recorder::Scope rec (recorder, Recorder::Op::compare_difference, on) ;
+  if (on == compare.difference) { return ; }
+
+  compare.difference = on ;
+  emit compare_changed () ;
+}
+
+void Application::on_compare_offset (double x, double y) {
+  Recorder::Scope rec (recorder, Recorder::Op::compare_offset, x, y) ;
+  compare.x = x ;
+  compare.y = y ;
+  emit compare_changed () ;
+}
+
+void Application::on_board (bool on, const QVector<int> & images) {
+  QStringList indices ;
+  for (auto index : images) { indices << QString::number (index) ; }
+  Recorder::Scope rec (recorder, Recorder::Op::board, on ? 1 : 0, 0, indices.join (' ')) ;
+
+  board = on ;
+  board_images = images ;
+  emit board_changed () ;
+}
+
+void Application::override_state (Context::Ptr ctx, int index, const ImageState & state) {
+  state_override.index = -1 ;
+  if (! ctx || index < 0 || index >= ctx->images.size ()) { return ; }
+
+  auto stored = ctx->effective_state (index) ;
+  if (stored.x != state.x || stored.y != state.y || stored.z != state.z
+    || stored.rot != state.rot || stored.mirrored != state.mirrored)
+  {
+    state_override = StateOverride { ctx->id, index, state } ;
+  }
+}
+
+void Application::on_shuffle (bool on, quint32 seed) {
+  Recorder::Scope rec (recorder, Recorder::Op::shuffle,
+    on ? double (seed >> 16) : -1.0, seed & 0xffff) ;
+  if (current_context) {
+    auto ctx = current_context ;
+    ctx->shuffled = on ;
+    if (on) { ctx->order = Permutation (ctx->images.size (), seed) ; }
+    context_is_dirty (ctx) ;
+    emit context_changed (ctx) ;
+    prefetch_upcoming () ;
   }
 }
 
@@ -633,10 +1005,92 @@ void Application::state_is_dirty (int index) {
   if (current_context) {
     context_is_dirty () ;
     if (index == -1) { index = current_context->current_image_index ; }
-    if (index >= 0) { current_context->dirty_states.insert (index) ; }
+    if (index >= 0 && index < current_context->dirty_states.size ()) {
+      current_context->dirty_states.setBit (index) ;
+    }
   }
 }
 
+// schema changes since 0.0.1, applied in order on every open ; fresh
+// databases are created at 0.0.1 and walk the same path
+struct Migration {
+  const char * version ;
+  QStringList statements ;
+} ;
+
+static const QList<Migration> & migrations () {
+  static const QList<Migration> steps = {
+    { "0.0.2", {
+      "alter table context add column generation int default 0",
+      "alter table context add column base_x real default 0",
+      "alter table context add column base_y real default 0",
+      "alter table context add column base_z real default 1",
+      "alter table context add column base_rot real default 0",
+      "alter table context add column base_mirrored bool default 0",
+      "alter table context add column base_pristine bool default 1",
+      "alter table context add column rot_gen int default 0",
+      "alter table context add column mirror_gen int default 0",
+      "alter table context add column place_gen int default 0",
+      "alter table image_state add column generation int default 0"
+    } },
+    { "0.0.3", {
+      "alter table context add column shuffled bool default 0",
+      "alter table context add column shuffle_seed int default 0"
+    } },
+    { "0.0.4", {
+      "create table palette (file varchar primary key, mtime int, colors varchar)"
+    } }
+  } ;
+  return steps ;
+}
+
+bool migrate_db () {
+  QSqlQuery query ;
+
+  auto check = [&query] () {
+    if (query.lastError ().isValid ()) {
+      cerr << "Error in migrate_db : " << endl ;
+      cerr << query.lastError ().text () << endl ;
+      return false ;
+    }
+
+    return true ;
+  } ;
+
+  query.exec ("select value from version") ;
+  if (!check ()) { return false ; }
+
+  auto version = QVersionNumber (0, 0, 1) ;
+  if (query.next ()) {
+    version = QVersionNumber::fromString (query.value (0).toString ()) ;
+  }
+
+  for (const auto & step : migrations ()) {
+    auto target = QVersionNumber::fromString (step.version) ;
+    if (version >= target) { continue ; }
+
+    query.exec ("begin transaction") ;
+    if (!check ()) { return false ; }
+
+    for (const auto & statement : step.statements) {
+      query.exec (statement) ;
+      if (!check ()) { query.exec ("rollback") ; return false ; }
+    }
+
+    query.prepare ("update version set value=:version") ;
+    query.bindValue (":version", step.version) ;
+    query.exec () ;
+    if (!check ()) { query.exec ("rollback") ; return false ; }
+
+    query.exec ("end transaction") ;
+    if (!check ()) { return false ; }
+
+    version = target ;
+  }
+
+  return true ;
+}
+
 bool setup_db (const QString & file) {
   auto db = QSqlDatabase::addDatabase ("QSQLITE") ;
   db.setDatabaseName (file) ;
@@ -663,10 +1117,11 @@ bool setup_db (const QString & file) {
     }
   }
 
-  return true ;
+  return migrate_db () ;
 }
 
 bool Application::read_from_db () {
+  TRACE_SCOPE ("read_from_db") ;
   QSqlQuery query ;
 
   auto check = [this, &query] () {
@@ -680,12 +1135,10 @@ bool Application::read_from_db () {
     return true ;
   } ;
 
-  query.exec ("select * from context") ;
+  query.exec ("select id, dir, current_image_index, step_mode, generation, base_x, base_y, base_z, base_rot, base_mirrored, base_pristine, rot_gen, mirror_gen, place_gen, shuffled, shuffle_seed from context") ;
 
   if (!check ()) { return false; }
 
-  QHash<QUuid,Context::Ptr> ctxmap ;
-
   while (query.next ()) {
     QUuid id = query.value (0).toUuid () ;
     QDir dir (query.value (1).toString ()) ;
@@ -694,8 +1147,19 @@ bool Application::read_from_db () {
 
     auto ctx = Context::Ptr::create (id, dir, current_image_index,
       int_to_stepmode (stepMode)) ;
-    all_contexts.push_back (ctx) ;
-    ctxmap[id] = ctx ;
+    ctx->generation = query.value (4).toInt () ;
+    ctx->base = ImageState (
+      query.value (5).toDouble (), query.value (6).toDouble (),
+      query.value (7).toDouble (), query.value (8).toDouble (),
+      query.value (9).toBool (), query.value (10).toBool ()) ;
+    ctx->rot_gen = query.value (11).toInt () ;
+    ctx->mirror_gen = query.value (12).toInt () ;
+    ctx->place_gen = query.value (13).toInt () ;
+    ctx->shuffled = query.value (14).toBool () ;
+    // sized by reset_states once the images are in
+    ctx->order = Permutation (0, static_cast<quint32> (query.value (15).toLongLong ())) ;
+    ctx->persisted = true ;
+    add_context (ctx) ;
   }
 
   if (all_contexts.size () == 0) { return true ; }
@@ -708,9 +1172,8 @@ bool Application::read_from_db () {
     current_ctx_id = query.value (0).toUuid () ;
   }
 
-  if (ctxmap.contains (current_ctx_id)) {
-    current_context = ctxmap[current_ctx_id] ;
-  } else { 
+  current_context = find_context (current_ctx_id) ;
+  if (! current_context) {
     current_context = all_contexts.at (0) ;
   }
 
@@ -722,19 +1185,28 @@ bool Application::read_from_db () {
     auto img_index = query.value (1).toInt () ;
     auto image_filename = query.value (2).toString () ;
 
-    auto ctx = ctxmap[ctx_id] ;
+    auto ctx = find_context (ctx_id) ;
+    if (! ctx) {
+      cerr << "invalid ctx_id in images : " << ctx_id.toString () << endl ;
+      return false ;
+    }
+
     ctx->images.push_back (image_filename) ;
     if (ctx->images.size () != img_index + 1) {
       return false ;
     }
   }
 
-  query.exec ("select * from image_state") ;
+  for (auto ctx : all_contexts) {
+    ctx->reset_states () ;
+  }
+
+  query.exec ("select context_id, image_index, x, y, z, rot, mirrored, pristine, generation from image_state") ;
   if (!check ()) { return false; }
   while (query.next ()) {
     auto ctx_id = query.value (0).toUuid () ;
-    if (ctxmap.contains (ctx_id)) {
-      auto ctx = ctxmap[ctx_id] ;
+    auto ctx = find_context (ctx_id) ;
+    if (ctx) {
       auto img_idx = query.value (1).toInt () ;
       auto x = query.value (2).toDouble () ;
       auto y = query.value (3).toDouble () ;
@@ -742,19 +1214,31 @@ bool Application::read_from_db () {
       auto rot = query.value (5).toDouble () ;
       auto mirrored = query.value (6).toBool () ;
       auto pristine = query.value (7).toBool () ;
+      auto generation = query.value (8).toInt () ;
+
+      auto state = ctx->state (img_idx) ;
+      if (! state) {
+        cerr << "image_state out of range : " << ctx_id.toString ()
+             << " / " << img_idx << endl ;
+        continue ;
+      }
 
-      ctx->states.insert (img_idx,
-        ImageState::Ptr::create (x, y, z, rot, mirrored, pristine)) ;
+      *state = ImageState (x, y, z, rot, mirrored, pristine) ;
+      ctx->state_gens[img_idx] = generation ;
+      ctx->persisted_states.setBit (img_idx) ;
     } else {
       cerr << "invalid ctx_id in images : " << ctx_id.toString () << endl ;
       return false ;
     }
   }
 
+  account_contexts () ;
   return true ;
 }
 
 void Application::flush_to_db () {
+  Recorder::Scope rec (recorder, Recorder::Op::save) ;
+  TRACE_SCOPE ("flush_to_db") ;
   QSqlQuery query ;
 
   auto check = [this, &query] () {
@@ -805,71 +1289,77 @@ void Application::flush_to_db () {
 
   if (!check ()) { return ; }
 
-  QSet<QUuid> saved_ctxs ;
-  query.exec ("select id from context") ;
-  while (query.next ()) {
-    saved_ctxs.insert (query.value (0).toUuid ()) ;
-  }
-  // sendPostedEvents () ; processEvents () ;
+  // rows inserted by this flush, folded into the persisted shadow
+  // once the transaction has committed
+  QList<QPair<Context::Ptr,QList<int>>> inserted ;
+
+  auto bind_base = [&query] (Context::Ptr ctx) {
+    query.bindValue (":generation", ctx->generation) ;
+    query.bindValue (":base_x", ctx->base.x) ;
+    query.bindValue (":base_y", ctx->base.y) ;
+    query.bindValue (":base_z", ctx->base.z) ;
+    query.bindValue (":base_rot", ctx->base.rot) ;
+    query.bindValue (":base_mirrored", ctx->base.mirrored) ;
+    query.bindValue (":base_pristine", ctx->base.pristine) ;
+    query.bindValue (":rot_gen", ctx->rot_gen) ;
+    query.bindValue (":mirror_gen", ctx->mirror_gen) ;
+    query.bindValue (":place_gen", ctx->place_gen) ;
+    query.bindValue (":shuffled", ctx->shuffled) ;
+    query.bindValue (":shuffle_seed", static_cast<qint64> (ctx->order.seed ())) ;
+  } ;
 
-  if (!check ()) { return ; }
+  QSetIterator<QUuid> dirty (dirty_contexts) ;
+  while (dirty.hasNext ()) {
 
-  for (int i = 0 ; i < all_contexts.size () ; i ++) {
+    auto ctx = find_context (dirty.next ()) ;
 
-    auto ctx = all_contexts.at (i) ;
+    if (ctx) {
 
-    if (dirty_contexts.contains (ctx->id)) {
+      QList<int> inserted_states ;
 
-      if (saved_ctxs.contains (ctx->id)) {
+      if (ctx->persisted) {
 
-        query.prepare ("update context set current_image_index=:current_image_index , step_mode=:step_mode where id=:context_id") ;
+        query.prepare ("update context set current_image_index=:current_image_index , step_mode=:step_mode , generation=:generation , base_x=:base_x , base_y=:base_y , base_z=:base_z , base_rot=:base_rot , base_mirrored=:base_mirrored , base_pristine=:base_pristine , rot_gen=:rot_gen , mirror_gen=:mirror_gen , place_gen=:place_gen , shuffled=:shuffled , shuffle_seed=:shuffle_seed where id=:context_id") ;
         query.bindValue (":context_id", ctx->id) ;
         query.bindValue (":current_image_index", ctx->current_image_index) ;
         query.bindValue (":step_mode", stepmode_to_int (ctx->stepMode)) ;
+        bind_base (ctx) ;
         query.exec () ;
         // sendPostedEvents () ; processEvents () ;
 
         if (!check ()) { return ; }
 
-        QSet<int> saved_states ;
-        query.prepare ("select image_index from image_state where context_id=:context_id") ;
-        query.bindValue (":context_id", ctx->id) ;
-        query.exec () ;
-        while (query.next ()) {
-          saved_states.insert (query.value (0).toInt ()) ;
-        }
-        // sendPostedEvents () ; processEvents () ;
+        for (int index = 0 ; index < ctx->dirty_states.size () ; index++) {
+          if (! ctx->dirty_states.testBit (index)) { continue ; }
+          if (! ctx->has_state (index)) { continue ; }
+          const auto & state = ctx->states.at (index) ;
 
-        if (!check ()) { return ; }
-
-        QSetIterator<int> iter (ctx->dirty_states) ;
-        while (iter.hasNext ()) {
-          auto index = iter.next () ;
-          auto state = ctx->states[index] ;
-
-          if (saved_states.contains (index)) {
-            query.prepare ("update image_state set x=:state_x , y=:state_y , z=:state_z , rot=:state_rot , mirrored=:state_mirrored , pristine=:state_pristine where context_id=:context_id and image_index=:image_index") ;
+          if (ctx->persisted_states.testBit (index)) {
+            query.prepare ("update image_state set x=:state_x , y=:state_y , z=:state_z , rot=:state_rot , mirrored=:state_mirrored , pristine=:state_pristine , generation=:state_generation where context_id=:context_id and image_index=:image_index") ;
             query.bindValue (":context_id", ctx->id) ;
             query.bindValue (":image_index", index) ;
-            query.bindValue (":state_x", state->x) ;
-            query.bindValue (":state_y", state->y) ;
-            query.bindValue (":state_z", state->z) ;
-            query.bindValue (":state_rot", state->rot) ;
-            query.bindValue (":state_mirrored", state->mirrored) ;
-            query.bindValue (":state_pristine", state->pristine) ;
+            query.bindValue (":state_x", state.x) ;
+            query.bindValue (":state_y", state.y) ;
+            query.bindValue (":state_z", state.z) ;
+            query.bindValue (":state_rot", state.rot) ;
+            query.bindValue (":state_mirrored", state.mirrored) ;
+            query.bindValue (":state_pristine", state.pristine) ;
+            query.bindValue (":state_generation", ctx->state_gens.at (index)) ;
             query.exec () ;
             // sendPostedEvents () ; processEvents () ;
           } else {
-            query.prepare ("insert into image_state values (:context_id, :image_index, :state_x, :state_y, :state_z, :state_rot, :state_mirrored, :state_pristine)") ;
+            query.prepare ("insert into image_state (context_id, image_index, x, y, z, rot, mirrored, pristine, generation) values (:context_id, :image_index, :state_x, :state_y, :state_z, :state_rot, :state_mirrored, :state_pristine, :state_generation)") ;
             query.bindValue (":context_id", ctx->id) ;
             query.bindValue (":image_index", index) ;
-            query.bindValue (":state_x", state->x) ;
-            query.bindValue (":state_y", state->y) ;
-            query.bindValue (":state_z", state->z) ;
-            query.bindValue (":state_rot", state->rot) ;
-            query.bindValue (":state_mirrored", state->mirrored) ;
-            query.bindValue (":state_pristine", state->pristine) ;
+            query.bindValue (":state_x", state.x) ;
+            query.bindValue (":state_y", state.y) ;
+            query.bindValue (":state_z", state.z) ;
+            query.bindValue (":state_rot", state.rot) ;
+            query.bindValue (":state_mirrored", state.mirrored) ;
+            query.bindValue (":state_pristine", state.pristine) ;
+            query.bindValue (":state_generation", ctx->state_gens.at (index)) ;
             query.exec () ;
+            inserted_states << index ;
             // sendPostedEvents () ; processEvents () ;
           }
         }
@@ -878,78 +1368,297 @@ void Application::flush_to_db () {
 
       } else {
 
-        query.prepare ("insert into context values (:context_id, :context_dir, :current_image_index, :step_mode)") ;
+        query.prepare ("insert into context (id, dir, current_image_index, step_mode, generation, base_x, base_y, base_z, base_rot, base_mirrored, base_pristine, rot_gen, mirror_gen, place_gen, shuffled, shuffle_seed) values (:context_id, :context_dir, :current_image_index, :step_mode, :generation, :base_x, :base_y, :base_z, :base_rot, :base_mirrored, :base_pristine, :rot_gen, :mirror_gen, :place_gen, :shuffled, :shuffle_seed)") ;
         query.bindValue (":context_id", ctx->id) ;
         query.bindValue (":context_dir", ctx->dir.absolutePath ()) ;
         query.bindValue (":current_image_index", ctx->current_image_index) ;
         query.bindValue (":step_mode", stepmode_to_int (ctx->stepMode)) ;
+        bind_base (ctx) ;
         query.exec () ;
 
         if (!check ()) { return ; }
 
-        for (int img_index = 0 ; img_index < ctx->images.size (); img_index++) {
-          auto img_name = ctx->images.at (img_index) ;
+        FilenameStore::Cursor cursor (ctx->images) ;
+        while (cursor.next ()) {
+          auto img_index = cursor.index () ;
 
           query.prepare ("insert into context_mem_images values (:context_id, :index, :image)") ;
           query.bindValue (":context_id", ctx->id) ;
           query.bindValue (":index", img_index) ;
-          query.bindValue (":image", img_name) ;
+          query.bindValue (":image", cursor.name ()) ;
           query.exec () ;
           // sendPostedEvents () ; processEvents () ;
 
-          if (ctx->states.contains (img_index)) {
-            auto state = ctx->states[img_index] ;
-            
-            query.prepare ("insert into image_state values (:context_id, :image_index, :state_x, :state_y, :state_z, :state_rot, :state_mirrored, :state_pristine)") ;
+          if (ctx->has_state (img_index)) {
+            const auto & state = ctx->states.at (img_index) ;
+
+            query.prepare ("insert into image_state (context_id, image_index, x, y, z, rot, mirrored, pristine, generation) values (:context_id, :image_index, :state_x, :state_y, :state_z, :state_rot, :state_mirrored, :state_pristine, :state_generation)") ;
             query.bindValue (":context_id", ctx->id) ;
             query.bindValue (":image_index", img_index) ;
-            query.bindValue (":state_x", state->x) ;
-            query.bindValue (":state_y", state->y) ;
-            query.bindValue (":state_z", state->z) ;
-            query.bindValue (":state_rot", state->rot) ;
-            query.bindValue (":state_mirrored", state->mirrored) ;
-            query.bindValue (":state_pristine", state->pristine) ;
+            query.bindValue (":state_x", state.x) ;
+            query.bindValue (":state_y", state.y) ;
+            query.bindValue (":state_z", state.z) ;
+            query.bindValue (":state_rot", state.rot) ;
+            query.bindValue (":state_mirrored", state.mirrored) ;
+            query.bindValue (":state_pristine", state.pristine) ;
+            query.bindValue (":state_generation", ctx->state_gens.at (img_index)) ;
             query.exec () ;
+            inserted_states << img_index ;
             // sendPostedEvents () ; processEvents () ;
           }
         }
 
         if (!check ()) { return ; }
       }
+
+      inserted << qMakePair (ctx, inserted_states) ;
     }
   }
 
-  dirty_contexts.clear () ;
-
   query.exec ("end transaction") ;
   if (!check ()) { return ; }
+
+  for (const auto & entry : inserted) {
+    auto ctx = entry.first ;
+    for (auto index : entry.second) {
+      ctx->persisted_states.setBit (index) ;
+    }
+    ctx->persisted = true ;
+    ctx->dirty_states.fill (false) ;
+  }
+
+  dirty_contexts.clear () ;
 }
 
-int Application::exec (QWidget * widget) {
-  auto args = app->arguments () ;
-  if (args.size () < 2) {
+// sqlite does not say how much of its page cache is in use through the
+// Qt driver, so this is what the cache may grow to
+static qint64 sqlite_cache_bytes () {
+  QSqlQuery query ;
+  qint64 page_size = 0, cache_size = 0 ;
+
+  if (query.exec ("pragma page_size") && query.next ()) {
+    page_size = query.value (0).toLongLong () ;
+  }
+  if (query.exec ("pragma cache_size") && query.next ()) {
+    cache_size = query.value (0).toLongLong () ;
+  }
+
+  // a negative cache_size is in KiB, a positive one in pages
+  return cache_size < 0 ? - cache_size * 1024 : cache_size * page_size ;
+}
+
+bool Application::open_backend () {
+  auto args = cmdline.positionalArguments () ;
+  if (args.size () < 1) {
     cerr << "Please provide sqlite backend file." << endl ;
-    return EXIT_FAILURE ;
+    return false ;
   } else {
-    auto sqlite_file = args.at (1) ;
+    auto sqlite_file = args.at (0) ;
     if (! setup_db (sqlite_file)) {
       cerr << "Failed to setup database : " << sqlite_file << endl ;
-      return EXIT_FAILURE ;
+      return false ;
     } else if (! read_from_db ()) {
       cerr << "Failed to read database : " << sqlite_file << endl ;
+      return false ;
+    }
+  }
+
+  mem.set (MemStats::sqlite, sqlite_cache_bytes ()) ;
+  return true ;
+}
+
+int Application::exec (QWidget * widget) {
+  if (! open_backend ()) {
+    return EXIT_FAILURE ;
+  } else {
+    auto timer = new QTimer (this) ;
+    timer->setSingleShot (true) ;
+    timer->setInterval (0) ;
+    connect (timer, &QTimer::timeout, this, &Application::on_startup) ;
+    timer->start () ;
+    commands->attach_stdin () ;
+
+    if (cmdline.isSet ("record")) {
+      recorder = new Recorder () ;
+      if (! recorder->open (cmdline.value ("record"))) { return EXIT_FAILURE ; }
+    }
+
+    auto control = cmdline.value ("control") ;
+    if (control.isEmpty ()) {
+      control = qEnvironmentVariable ("IMVIEW_CONTROL") ;
+    }
+    // gone before the app, and so before commands, whose sessions it holds
+    QScopedPointer<ControlServer> server ;
+    if (! control.isEmpty ()) {
+      server.reset (new ControlServer (commands, nullptr)) ;
+      if (! server->listen (control)) { return EXIT_FAILURE ; }
+    }
+
+    widget->setWindowFlag(Qt::WindowStaysOnTopHint);
+    widget->show () ;
+    widget->move(3, 107);
+    auto result = QApplication::exec () ;
+    finish_trace () ;
+    if (recorder) {
+      delete recorder ;
+      recorder = nullptr ;
+    }
+    return result ;
+  }
+}
+
+void Application::finish_trace () {
+  if (Trace::enabled () && ! trace_file.isEmpty ()) {
+    Trace::dump (trace_file) ;
+  }
+}
+
+static const char * headless_options [] = { "--export", "--bench-nav", "--replay" } ;
+
+bool Application::is_headless (int argc, char ** argv) {
+  for (int i = 1 ; i < argc ; i++) {
+    for (auto option : headless_options) {
+      if (QString (argv[i]).section ('=', 0, 0) == option) { return true ; }
+    }
+  }
+  return false ;
+}
+
+bool Application::headless () const {
+  for (auto option : headless_options) {
+    if (cmdline.isSet (QString (option).mid (2))) { return true ; }
+  }
+  return false ;
+}
+
+int Application::exec_headless () {
+  int result = EXIT_FAILURE ;
+
+  // benchmarks never touch the user's backend
+  if (cmdline.isSet ("bench-nav")) {
+    result = run_nav_bench () ;
+  } else if (cmdline.isSet ("replay")) {
+    result = run_replay () ;
+  } else if (open_backend () && cmdline.isSet ("export")) {
+    result = run_export () ;
+  }
+
+  finish_trace () ;
+  return result ;
+}
+
+int Application::run_export () {
+  Context::List targets ;
+  auto wanted = cmdline.value ("export") ;
+  if (wanted == "all") {
+    targets = all_contexts ;
+  } else if (auto ctx = match_context (wanted)) {
+    targets << ctx ;
+  } else {
+    cerr << "No such context : " << wanted << endl ;
+    return EXIT_FAILURE ;
+  }
+
+  QSize canvas ;
+  if (cmdline.isSet ("size")) {
+    auto parts = cmdline.value ("size").split ('x') ;
+    if (parts.size () == 2) {
+      canvas = QSize (parts.at (0).toInt (), parts.at (1).toInt ()) ;
+    }
+    if (! canvas.isValid () || canvas.isEmpty ()) {
+      cerr << "Invalid size : " << cmdline.value ("size") << endl ;
       return EXIT_FAILURE ;
-    }else {
-      auto timer = new QTimer (this) ;
-      timer->setSingleShot (true) ;
-      timer->setInterval (0) ;
-      connect (timer, &QTimer::timeout, this, &Application::on_startup) ;
-      timer->start () ;
-      widget->setWindowFlag(Qt::WindowStaysOnTopHint);
-      widget->show () ;
-      widget->move(3, 107);
-      return QApplication::exec () ;
     }
   }
+
+  int failed = 0 ;
+  for (auto ctx : targets) {
+    QDir out (cmdline.value ("out")) ;
+    if (targets.size () > 1) {
+      out = QDir (out.absoluteFilePath (ctx->id.toString ().mid (1, 8))) ;
+    }
+
+    Exporter exporter (out.absolutePath (), cmdline.value ("format"),
+      canvas, cmdline.value ("jobs").toInt ()) ;
+    failed += exporter.run (ctx) ;
+  }
+
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE ;
+}
+
+bool Application::write_report (const QJsonObject & report) {
+  auto json = QJsonDocument (report).toJson (QJsonDocument::Indented) ;
+
+  if (cmdline.isSet ("json")) {
+    QFile file (cmdline.value ("json")) ;
+    if (! file.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+      cerr << "Cannot write report : " << file.fileName () << endl ;
+      return false ;
+    }
+    file.write (json) ;
+  } else {
+    std::cout << json.constData () << std::flush ;
+  }
+
+  return true ;
+}
+
+int Application::run_replay () {
+  QVector<Recorder::Event> events ;
+  if (! Recorder::load (cmdline.value ("replay"), events)) { return EXIT_FAILURE ; }
+
+  // flushes hit a real file, but never the user's backend
+  QTemporaryDir tmp ;
+  if (! tmp.isValid () || ! setup_db (tmp.filePath ("replay.sqlite"))) {
+    cerr << "Failed to setup replay database" << endl ;
+    return EXIT_FAILURE ;
+  }
+
+  Replayer replayer (events) ;
+  auto report = replayer.run (cmdline.value ("speed") == "recorded") ;
+  if (report.isEmpty ()) { return EXIT_FAILURE ; }
+
+  auto frame = report["frame"].toObject () ;
+  auto flush = report["flush"].toObject () ;
+  cerr << "calls " << report["calls"].toInt ()
+       << " : frame p50 " << frame["p50_ms"].toDouble ()
+       << " / p95 " << frame["p95_ms"].toDouble ()
+       << " / max " << frame["max_ms"].toDouble () << " ms"
+       << ", flushes " << flush["count"].toInt ()
+       << " p95 " << flush["p95_ms"].toDouble () << " ms"
+       << ", wall " << report["wall_ms"].toDouble () << " ms"
+       << endl ;
+
+  return write_report (report) ? EXIT_SUCCESS : EXIT_FAILURE ;
+}
+
+int Application::run_nav_bench () {
+  if (! setup_db (":memory:")) {
+    cerr << "Failed to setup in-memory database" << endl ;
+    return EXIT_FAILURE ;
+  }
+
+  NavBench bench (QDir (cmdline.value ("bench-nav"))) ;
+  if (! bench.parse (cmdline.value ("sequence"))) {
+    cerr << "Invalid sequence : " << cmdline.value ("sequence") << endl ;
+    return EXIT_FAILURE ;
+  }
+
+  auto report = bench.run () ;
+  if (report.isEmpty ()) { return EXIT_FAILURE ; }
+
+  auto sw = report["switch"].toObject () ;
+  auto dec = report["decode"].toObject () ;
+  cerr << "switches " << sw["count"].toInt ()
+       << " : p50 " << sw["p50_ms"].toDouble ()
+       << " / p95 " << sw["p95_ms"].toDouble ()
+       << " / p99 " << sw["p99_ms"].toDouble () << " ms"
+       << ", decode p50 " << dec["p50_ms"].toDouble () << " ms"
+       << ", " << report["switches_per_s"].toDouble () << " switches/s"
+       << ", peak rss " << report["peak_rss_kb"].toDouble () / 1024 << " MB"
+       << endl ;
+
+  return write_report (report) ? EXIT_SUCCESS : EXIT_FAILURE ;
 }
 
 void
@@ -958,14 +1667,9 @@ Application::dump_cur_state () {
     auto ctx = current_context ;
     auto cur_index = ctx->current_image_index ;
 
-    ImageState::Ptr state ;
-    if (ctx->states.contains (cur_index)) {
-      state = ctx->states[cur_index] ;
-    } else {
-      state = ImageState::Ptr::create () ;
-    }
+    auto state = ctx->effective_state (cur_index) ;
 
-    cerr << "index = " << cur_index << ", state = " << (*state) << endl ;
+    cerr << "index = " << cur_index << ", state = " << state << endl ;
   }
 }
 
@@ -0,0 +1,218 @@
+#include "Application.hpp"
+#include "BoardView.hpp"
+#include "ImageCache.hpp"
+#include "MemStats.hpp"
+#include "Trace.hpp"
+
+#include <QGraphicsScene>
+#include <QStyleOptionGraphicsItem>
+#include <QPainter>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include <QSet>
+#include <QtMath>
+
+namespace {
+
+// pixmaps the board keeps before it lets go of those off screen
+const qint64 pixmap_budget = 256ll << 20 ;
+
+const qreal scene_side = 20000 ;
+
+}
+
+BoardItem::BoardItem (BoardView * board, const QString & file, int index, qreal cell)
+  : file (file)
+  , index (index)
+  , board (board)
+  , cell (cell)
+  , level (-1)
+  , pending (false)
+{ }
+
+QRectF BoardItem::boundingRect () const {
+  // a margin around each image, even when it fills its cell
+  auto side = cell * 0.92 ;
+  if (size.isEmpty ()) { return QRectF (- side / 2, - side / 2, side, side) ; }
+
+  QSizeF fitted = QSizeF (size).scaled (side, side, Qt::KeepAspectRatio) ;
+  return QRectF (- fitted.width () / 2, - fitted.height () / 2, fitted.width (), fitted.height ()) ;
+}
+
+void BoardItem::paint (QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget *) {
+  auto rect = boundingRect () ;
+  auto spec = app->view_filter ;
+  // what the image is fitted in, in screen pixels
+  auto lod = option->levelOfDetailFromTransform (painter->worldTransform ()) ;
+  auto box = rect.size () * lod ;
+
+  if (size.isEmpty ()) {
+    // decoded in the background at the level it shows at, drawn once
+    // prepared ; a file that fails to decode is not asked for again
+    if (! pending) { app->cache->prefetch_background (file, box, spec) ; }
+    pending = true ;
+  } else {
+    // the same scale the prefetch picks its level with
+    auto wanted = ImageCache::level_for (size, ImageCache::fit_scale (size, box)) ;
+    if (wanted != level) {
+      auto image = app->cache->peek (file, wanted, spec) ;
+      if (image.isNull ()) {
+        // keeps drawing the level it has meanwhile
+        if (! pending) { app->cache->prefetch_background (file, box, spec) ; }
+        pending = true ;
+      } else {
+        TRACE_SCOPE ("board_upload") ;
+        board->account (- MemStats::bytes_of (pixmap)) ;
+        pixmap = QPixmap::fromImage (image) ;
+        board->account (MemStats::bytes_of (pixmap)) ;
+        level = wanted ;
+      }
+    }
+  }
+
+  if (pixmap.isNull ()) {
+    painter->fillRect (rect, QColor (40, 40, 40)) ;
+    return ;
+  }
+  painter->setRenderHint (QPainter::SmoothPixmapTransform) ;
+  painter->drawPixmap (rect, pixmap, QRectF (pixmap.rect ())) ;
+}
+
+void BoardItem::prepared (const QSize & full) {
+  pending = false ;
+  if (size.isEmpty () && ! full.isEmpty ()) {
+    prepareGeometryChange () ;
+    size = full ;
+  }
+  update () ;
+}
+
+void BoardItem::release () {
+  if (pixmap.isNull ()) { return ; }
+  board->account (- MemStats::bytes_of (pixmap)) ;
+  pixmap = QPixmap () ;
+  level = -1 ;
+  pending = false ;
+}
+
+BoardView::~BoardView () {
+  clear () ;
+}
+
+BoardView::BoardView (QWidget * parent)
+  : QGraphicsView (parent)
+  , pixmap_bytes (0)
+{
+  setHorizontalScrollBarPolicy (Qt::ScrollBarAlwaysOff) ;
+  setVerticalScrollBarPolicy (Qt::ScrollBarAlwaysOff) ;
+  setDragMode (QGraphicsView::ScrollHandDrag) ;
+  setTransformationAnchor (QGraphicsView::AnchorUnderMouse) ;
+  // items paint whole, the pixmaps are smaller than the screen anyway
+  setViewportUpdateMode (QGraphicsView::SmartViewportUpdate) ;
+
+  scene = QSharedPointer<QGraphicsScene>::create () ;
+  // culling : only items in the exposed area are found and painted
+  scene->setItemIndexMethod (QGraphicsScene::BspTreeIndex) ;
+  scene->setSceneRect (QRectF (0, 0, scene_side, scene_side)) ;
+  scene->setBackgroundBrush (QBrush (Qt::black)) ;
+  setScene (scene.data ()) ;
+
+  connect (app->cache, &ImageCache::prepared, this,
+    [this] (const QString & file, const QSize & size) {
+      auto item = items.value (file) ;
+      if (item) { item->prepared (size) ; }
+    }, Qt::QueuedConnection) ;
+
+  connect (app, &Application::view_filter_changed, this, &BoardView::refresh) ;
+}
+
+void BoardView::clear () {
+  // the views need the worker, and their get () must not wait for these
+  app->cache->cancel_background () ;
+  items.clear () ;
+  scene->clear () ;
+  pixmap_bytes = 0 ;
+  app->mem.set (MemStats::board, 0) ;
+}
+
+void BoardView::show_context (Application::Context::Ptr ctx, const QVector<int> & indices) {
+  TRACE_SCOPE ("board") ;
+  clear () ;
+  if (! ctx || ctx->images.size () == 0) { return ; }
+
+  QVector<int> shown = indices ;
+  if (shown.isEmpty ()) {
+    for (int i = 0 ; i < ctx->images.size () ; i++) { shown << i ; }
+  }
+
+  // a square grid around the centre of the scene
+  int columns = qCeil (qSqrt (shown.size ())) ;
+  int rows = (shown.size () + columns - 1) / columns ;
+  qreal cell = qMin (qreal (1024), scene_side / columns) ;
+  QPointF origin (scene_side / 2 - columns * cell / 2, scene_side / 2 - rows * cell / 2) ;
+
+  for (int k = 0 ; k < shown.size () ; k++) {
+    int index = shown.at (k) ;
+    if (index < 0 || index >= ctx->images.size ()) { continue ; }
+    auto file = ctx->dir.absoluteFilePath (ctx->images.at (index)) ;
+    // the same file twice would share its entry, one item is enough
+    if (items.contains (file)) { continue ; }
+
+    auto item = new BoardItem (this, file, index, cell) ;
+    auto state = ctx->effective_state (index) ;
+    QTransform transform ;
+    transform.rotate (state.rot) ;
+    transform.scale (state.mirrored ? - state.scale () : state.scale (), state.scale ()) ;
+    item->setTransform (transform) ;
+    item->setPos (origin + QPointF ((k % columns + 0.5) * cell, (k / columns + 0.5) * cell)) ;
+    scene->addItem (item) ;
+    items.insert (file, item) ;
+
+    // sized already when the cache has it
+    auto base = app->cache->peek (file, 0) ;
+    if (! base.isNull ()) { item->prepared (base.size ()) ; }
+  }
+
+  // everything in sight to start with
+  fitInView (scene->itemsBoundingRect (), Qt::KeepAspectRatio) ;
+}
+
+void BoardView::refresh () {
+  for (auto item : items) { item->release () ; }
+  viewport ()->update () ;
+}
+
+void BoardView::account (qint64 delta) {
+  pixmap_bytes += delta ;
+  app->mem.set (MemStats::board, pixmap_bytes) ;
+  // only growth trims, releasing must not trim again
+  if (delta > 0 && pixmap_bytes > pixmap_budget) { trim () ; }
+}
+
+void BoardView::trim () {
+  // the index answers what is in sight, the rest can go
+  auto visible = mapToScene (viewport ()->rect ()).boundingRect () ;
+  QSet<QGraphicsItem *> keep ;
+  for (auto item : scene->items (visible)) { keep.insert (item) ; }
+  for (auto item : items) {
+    if (! keep.contains (item)) { item->release () ; }
+  }
+}
+
+void BoardView::wheelEvent (QWheelEvent * evt) {
+  auto factor = qPow (1.0015, evt->angleDelta ().y ()) ;
+  // from one whole board down to a few pixels of one image
+  auto zoom = transform ().m11 () * factor ;
+  if (zoom < 0.01 || zoom > 40) { return ; }
+  scale (factor, factor) ;
+  evt->accept () ;
+}
+
+void BoardView::mouseDoubleClickEvent (QMouseEvent * evt) {
+  auto item = dynamic_cast<BoardItem *> (itemAt (evt->pos ())) ;
+  if (! item) { return ; }
+  // leaving the board clears it, item included
+  int index = item->index ;
+  app->on_board (false) ;
+  app->on_imgJumpSpecific (index) ;
+}
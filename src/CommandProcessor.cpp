@@ -0,0 +1,614 @@
+#include "Application.hpp"
+#include "CommandProcessor.hpp"
+#include "Trace.hpp"
+#include "PracticeTimer.hpp"
+
+#include <QSocketNotifier>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QRegularExpression>
+#include <QRandomGenerator>
+#include <QFileInfo>
+
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using std::cout ;
+using std::cerr ;
+using std::endl ;
+
+void LineBuffer::feed (const char * data, qint64 size) {
+  pending.append (data, static_cast<int> (size)) ;
+  if (pending.size () > max_line && pending.indexOf ('\n') < 0) {
+    cerr << "dropping overlong command line" << endl ;
+    pending.clear () ;
+  }
+}
+
+QStringList LineBuffer::take_lines () {
+  QStringList lines ;
+  int start = 0 ;
+  int end ;
+  while ((end = pending.indexOf ('\n', start)) >= 0) {
+    auto line = QString::fromUtf8 (pending.constData () + start, end - start).trimmed () ;
+    if (! line.isEmpty ()) { lines << line ; }
+    start = end + 1 ;
+  }
+  pending.remove (0, start) ;
+  return lines ;
+}
+
+QString LineBuffer::take_rest () {
+  auto line = QString::fromUtf8 (pending).trimmed () ;
+  pending.clear () ;
+  return line ;
+}
+
+CommandProcessor::Session::Session () : open_batches (0) { }
+
+CommandProcessor::Session::~Session () { }
+
+void CommandProcessor::Session::flush () { }
+
+class StdoutSession : public CommandProcessor::Session {
+  public :
+
+  virtual void send (const QByteArray & line) {
+    cout << line.constData () << '\n' ;
+  }
+
+  virtual void flush () {
+    cout.flush () ;
+  }
+} ;
+
+static QJsonObject state_json () ;
+
+CommandProcessor::~CommandProcessor () {
+  delete stdin_session ;
+}
+
+CommandProcessor::CommandProcessor (QObject * parent)
+  : QObject (parent)
+  , stdin_session (nullptr)
+{
+  add_builtin_commands () ;
+
+  connect (app, &Application::current_img_changed,
+    [this] () { publish ("current_img_changed", state_json ()) ; }) ;
+
+  connect (app, &Application::current_context_changed,
+    [this] () { publish ("current_context_changed", state_json ()) ; }) ;
+}
+
+void CommandProcessor::add_command (
+  const QString & name, const QString & usage, Handler handler)
+{
+  commands.insert (name, Command { usage, handler }) ;
+}
+
+QByteArray CommandProcessor::execute (const QString & line, Session * session) {
+  static const QRegularExpression spaces ("\\s+") ;
+
+  Request req ;
+  req.session = session ;
+  auto text = line.trimmed () ;
+  if (text.startsWith ('@')) {
+    int space = text.indexOf (' ') ;
+    req.tag = text.mid (1, space < 0 ? -1 : space - 1) ;
+    text = space < 0 ? QString () : text.mid (space + 1).trimmed () ;
+  }
+
+  int space = text.indexOf (' ') ;
+  req.name = text.left (space < 0 ? text.size () : space) ;
+  req.rest = space < 0 ? QString () : text.mid (space + 1).trimmed () ;
+  req.args = req.rest.split (spaces, QString::SkipEmptyParts) ;
+
+  QJsonObject reply ;
+  if (! req.tag.isEmpty ()) { reply["tag"] = req.tag ; }
+  reply["cmd"] = req.name ;
+
+  QJsonValue result ;
+  bool ok = false ;
+  if (commands.contains (req.name)) {
+    ok = commands[req.name].handler (req, result) ;
+  } else {
+    result = QString ("unknown command, try help") ;
+  }
+
+  reply["ok"] = ok ;
+  reply[ok ? "result" : "error"] = result ;
+
+  return QJsonDocument (reply).toJson (QJsonDocument::Compact) ;
+}
+
+void CommandProcessor::execute_batch (const QStringList & lines, Session * session) {
+  app->begin_batch () ;
+  for (const auto & line : lines) {
+    session->send (execute (line, session)) ;
+  }
+  app->end_batch () ;
+
+  session->flush () ;
+}
+
+void CommandProcessor::add_session (Session * session) {
+  sessions.push_back (session) ;
+}
+
+void CommandProcessor::remove_session (Session * session) {
+  sessions.removeAll (session) ;
+  end_batches (session) ;
+}
+
+void CommandProcessor::end_batches (Session * session) {
+  while (session->open_batches > 0) {
+    session->open_batches-- ;
+    app->end_batch () ;
+  }
+}
+
+void CommandProcessor::publish (const QString & event, const QJsonObject & data) {
+  QByteArray line ;
+  for (auto session : sessions) {
+    if (! session->subscriptions.contains (event)) { continue ; }
+
+    if (line.isEmpty ()) {
+      QJsonObject obj ;
+      obj["event"] = event ;
+      obj["data"] = data ;
+      line = QJsonDocument (obj).toJson (QJsonDocument::Compact) ;
+    }
+
+    session->send (line) ;
+    session->flush () ;
+  }
+}
+
+void CommandProcessor::attach_stdin () {
+  int fd = fileno (stdin) ;
+
+  stdin_session = new StdoutSession () ;
+  add_session (stdin_session) ;
+
+  auto sn = new QSocketNotifier (fd, QSocketNotifier::Read, this) ;
+
+  connect (sn, &QSocketNotifier::activated,
+      [this, sn] (int fd) {
+        // drain what is available, but yield back to the event loop
+        // after a bounded amount so a flood cannot starve painting.
+        // Reads are sized from FIONREAD so they never block : stdin stays
+        // blocking, as O_NONBLOCK would leak to stdout on a shared tty
+        char chunk [1 << 16] ;
+        qint64 total = 0 ;
+        bool closed = false ;
+        while (total < LineBuffer::max_line) {
+          int available = 0 ;
+          if (ioctl (fd, FIONREAD, &available) < 0) { available = 0 ; }
+          // readable with nothing buffered : the read reports the end
+          if (available == 0 && total > 0) { break ; }
+          size_t size = available > 0 ? qMin (size_t (available), sizeof (chunk)) : sizeof (chunk) ;
+
+          auto n = ::read (fd, chunk, size) ;
+          if (n > 0) {
+            stdin_buffer.feed (chunk, n) ;
+            total += n ;
+          } else if (n < 0 && errno == EINTR) {
+            continue ;
+          } else {
+            closed = true ;
+            break ;
+          }
+        }
+
+        auto lines = stdin_buffer.take_lines () ;
+        // an unterminated last line still runs
+        if (closed) { lines << stdin_buffer.take_rest () ; }
+        lines.removeAll (QString ()) ;
+        if (! lines.isEmpty ()) {
+          execute_batch (lines, stdin_session) ;
+        }
+
+        if (closed) {
+          sn->setEnabled (false) ;
+          end_batches (stdin_session) ;
+        }
+      }) ;
+}
+
+static QJsonObject state_json () {
+  QJsonObject obj ;
+  auto ctx = app->current_context ;
+  if (! ctx) { return obj ; }
+
+  obj["context"] = ctx->id.toString () ;
+  obj["dir"] = ctx->dir.absolutePath () ;
+  obj["index"] = ctx->current_image_index ;
+  obj["count"] = ctx->images.size () ;
+  obj["image"] = ctx->images.at (ctx->current_image_index) ;
+  obj["step_mode"] = stepmode_to_int (ctx->stepMode) ;
+  obj["shuffled"] = ctx->shuffled ;
+
+  auto state = app->current_state ;
+  if (state) {
+    obj["x"] = state->x ;
+    obj["y"] = state->y ;
+    obj["z"] = state->z ;
+    obj["rot"] = state->rot ;
+    obj["mirrored"] = state->mirrored ;
+    obj["pristine"] = state->pristine ;
+  }
+
+  return obj ;
+}
+
+static bool number_arg (const CommandProcessor::Request & req, int i,
+  double & value, QJsonValue & result)
+{
+  bool ok = false ;
+  if (i < req.args.size ()) { value = req.args.at (i).toDouble (&ok) ; }
+  if (! ok) { result = QString ("usage error : expected a number") ; }
+  return ok ;
+}
+
+void CommandProcessor::add_builtin_commands () {
+  typedef const Request & R ;
+  typedef QJsonValue & V ;
+
+  add_command ("help", "help", [this] (R, V result) {
+    QJsonObject obj ;
+    for (auto iter = commands.constBegin () ; iter != commands.constEnd () ; iter++) {
+      obj[iter.key ()] = iter.value ().usage ;
+    }
+    result = obj ;
+    return true ;
+  }) ;
+
+  add_command ("newdir", "newdir <path>", [] (R req, V result) {
+    QDir dir (req.rest) ;
+    if (req.rest.isEmpty () || ! dir.exists ()) {
+      result = QString ("no such directory") ;
+      return false ;
+    }
+    app->dir_selected (dir) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("next", "next", [] (R, V result) {
+    app->on_nextImage () ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("prev", "prev", [] (R, V result) {
+    app->on_prevImage () ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("jump", "jump <steps>", [] (R req, V result) {
+    double steps ;
+    if (! number_arg (req, 0, steps, result)) { return false ; }
+    app->on_imgJump (static_cast<int> (steps)) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("goto", "goto <index>", [] (R req, V result) {
+    double target ;
+    if (! number_arg (req, 0, target, result)) { return false ; }
+    app->on_imgJumpSpecific (static_cast<int> (target)) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("rotate", "rotate <degrees>", [] (R req, V result) {
+    double value ;
+    if (! number_arg (req, 0, value, result)) { return false ; }
+    app->on_rotation (value) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("mirror", "mirror [on|off]", [] (R req, V result) {
+    if (! app->current_state) { result = QString ("no image") ; return false ; }
+    bool want = ! app->current_state->mirrored ;
+    if (req.args.size () > 0) { want = (req.args.at (0) == "on") ; }
+    if (want != app->current_state->mirrored) { app->on_mirrorToggle () ; }
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("zoom", "zoom <z>", [] (R req, V result) {
+    double value ;
+    if (! number_arg (req, 0, value, result)) { return false ; }
+    app->on_zoom (value) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("translate", "translate <dx> <dy>", [] (R req, V result) {
+    double dx, dy ;
+    if (! number_arg (req, 0, dx, result)) { return false ; }
+    if (! number_arg (req, 1, dy, result)) { return false ; }
+    // translation goes through the view, which must show the current image
+    app->sync_batch () ;
+    app->push_translate (dx, dy) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("stepmode", "stepmode <0|15|225|30|45|120>", [] (R req, V result) {
+    double value ;
+    if (! number_arg (req, 0, value, result)) { return false ; }
+    // int_to_stepmode falls back on normal, only its own values round trip
+    auto mode = static_cast<int> (value) ;
+    if (mode != value || stepmode_to_int (int_to_stepmode (mode)) != mode) {
+      result = QString ("usage error : expected 0, 15, 225, 30, 45 or 120") ;
+      return false ;
+    }
+    app->on_stepModeChange (int_to_stepmode (mode)) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("save", "save", [] (R, V result) {
+    app->flush_to_db () ;
+    result = true ;
+    return true ;
+  }) ;
+
+  add_command ("context", "context <id or id prefix>", [] (R req, V result) {
+    auto ctx = app->match_context (req.rest) ;
+    if (! ctx) { result = QString ("no such context") ; return false ; }
+    app->on_context_selection (ctx->id) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("contexts", "contexts", [] (R, V result) {
+    QJsonArray list ;
+    for (auto ctx : app->all_contexts) {
+      QJsonObject obj ;
+      obj["id"] = ctx->id.toString () ;
+      obj["dir"] = ctx->dir.absolutePath () ;
+      obj["index"] = ctx->current_image_index ;
+      obj["count"] = ctx->images.size () ;
+      obj["current"] = (ctx == app->current_context) ;
+      list << obj ;
+    }
+    result = list ;
+    return true ;
+  }) ;
+
+  add_command ("state", "state", [] (R, V result) {
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("perf", "perf [reset]  (image switch latencies, per stage)", [] (R req, V result) {
+    result = app->perf.to_json () ;
+    if (req.args.value (0) == "reset") { app->perf.reset () ; }
+    return true ;
+  }) ;
+
+  add_command ("filter", "filter none|grayscale|notan2|notan3|notan5", [] (R req, V result) {
+    Filters::Value value ;
+    if (! Filters::value_from_name (req.args.value (0), value)) {
+      result = QString ("unknown filter") ;
+      return false ;
+    }
+    app->on_value_filter (value) ;
+    result = QString (Filters::value_name (app->view_filter.value)) ;
+    return true ;
+  }) ;
+
+  add_command ("squint", "squint <radius>|off", [] (R req, V result) {
+    bool ok = true ;
+    auto what = req.args.value (0) ;
+    int radius = what == "off" ? 0 : what.toInt (&ok) ;
+    if (! ok || radius < 0) {
+      result = QString ("usage error : expected a radius or off") ;
+      return false ;
+    }
+    app->on_blur (radius) ;
+    result = app->view_filter.blur ;
+    return true ;
+  }) ;
+
+  add_command ("edges", "edges <threshold>|off", [] (R req, V result) {
+    bool ok = true ;
+    auto what = req.args.value (0) ;
+    int threshold = what == "off" ? 0 : what.toInt (&ok) ;
+    if (! ok || threshold < 0) {
+      result = QString ("usage error : expected a threshold or off") ;
+      return false ;
+    }
+    app->on_edges (threshold) ;
+    result = app->edge_threshold ;
+    return true ;
+  }) ;
+
+  add_command ("compare", "compare <file>|off|opacity <percent>|difference on|off|offset <x> <y>",
+    [] (R req, V result) {
+    auto what = req.args.value (0) ;
+    bool ok = true, ok_y = true ;
+    if (what == "opacity") {
+      int percent = req.args.value (1).toInt (&ok) ;
+      if (ok) { app->on_compare_opacity (percent) ; }
+    } else if (what == "difference") {
+      auto on = req.args.value (1) ;
+      ok = on == "on" || on == "off" ;
+      if (ok) { app->on_compare_difference (on == "on") ; }
+    } else if (what == "offset") {
+      double x = req.args.value (1).toDouble (&ok) ;
+      double y = req.args.value (2).toDouble (&ok_y) ;
+      ok = ok && ok_y ;
+      if (ok) { app->on_compare_offset (x, y) ; }
+    } else if (what == "off") {
+      app->on_compare_open (QString ()) ;
+    } else if (QFileInfo (what).isFile ()) {
+      app->on_compare_open (QFileInfo (what).absoluteFilePath ()) ;
+    } else {
+      ok = false ;
+    }
+    if (! ok) {
+      result = QString ("usage error : see help") ;
+      return false ;
+    }
+
+    QJsonObject obj ;
+    obj["file"] = app->compare.file ;
+    obj["opacity"] = app->compare.opacity ;
+    obj["difference"] = app->compare.difference ;
+    obj["x"] = app->compare.x ;
+    obj["y"] = app->compare.y ;
+    result = obj ;
+    return true ;
+  }) ;
+
+  add_command ("board", "board on [index ...]|off", [] (R req, V result) {
+    auto what = req.args.value (0) ;
+    if (what != "on" && what != "off") {
+      result = QString ("expected on or off") ;
+      return false ;
+    }
+    QVector<int> images ;
+    for (int i = 1 ; i < req.args.size () ; i++) {
+      bool ok = false ;
+      images << req.args.at (i).toInt (&ok) ;
+      if (! ok) {
+        result = QString ("usage error : expected image indices") ;
+        return false ;
+      }
+    }
+    app->on_board (what == "on", images) ;
+    result = app->board ;
+    return true ;
+  }) ;
+
+  add_command ("shuffle", "shuffle on [seed]|off", [] (R req, V result) {
+    auto what = req.args.value (0) ;
+    if (what != "on" && what != "off") {
+      result = QString ("expected on or off") ;
+      return false ;
+    }
+    bool ok = true ;
+    quint32 seed = req.args.size () > 1
+      ? req.args.at (1).toUInt (&ok)
+      : QRandomGenerator::global ()->generate () ;
+    if (! ok) {
+      result = QString ("usage error : expected a seed") ;
+      return false ;
+    }
+    app->on_shuffle (what == "on", seed) ;
+    result = state_json () ;
+    return true ;
+  }) ;
+
+  add_command ("practice", "practice <seconds>|off", [] (R req, V result) {
+    auto what = req.args.value (0) ;
+    bool ok = false ;
+    int seconds = what.toInt (&ok) ;
+    if (what == "off") {
+      app->practice->stop () ;
+    } else if (ok && seconds > 0) {
+      app->practice->start (seconds) ;
+    } else {
+      result = QString ("expected seconds or off") ;
+      return false ;
+    }
+    QJsonObject obj ;
+    obj["interval"] = app->practice->interval () ;
+    obj["late_ms"] = app->practice->jitter ().to_json () ;
+    result = obj ;
+    return true ;
+  }) ;
+
+  add_command ("mem", "mem [reset]  (bytes held per category, with peaks)", [] (R req, V result) {
+    app->account_contexts () ;
+    result = app->mem.to_json () ;
+    if (req.args.value (0) == "reset") { app->mem.reset_peaks () ; }
+    return true ;
+  }) ;
+
+  add_command ("trace", "trace on|off|dump [file]", [] (R req, V result) {
+    auto what = req.args.value (0) ;
+    if (what == "on") {
+      Trace::enable () ;
+    } else if (what == "off") {
+      Trace::disable () ;
+    } else if (what == "dump") {
+      auto file = req.args.value (1, app->trace_file) ;
+      if (file.isEmpty ()) {
+        result = QString ("no trace file, give one or start with --trace") ;
+        return false ;
+      }
+      if (! Trace::dump (file)) {
+        result = QString ("cannot write %1").arg (file) ;
+        return false ;
+      }
+    } else {
+      result = QString ("expected on, off or dump") ;
+      return false ;
+    }
+    result = Trace::enabled () ;
+    return true ;
+  }) ;
+
+  static const QStringList events = {
+    "current_img_changed", "current_context_changed"
+  } ;
+
+  add_command ("subscribe", "subscribe <event|all>...", [] (R req, V result) {
+    auto wanted = req.args.contains ("all") ? events : req.args ;
+    for (const auto & event : wanted) {
+      if (! events.contains (event)) {
+        result = QString ("unknown event : %1").arg (event) ;
+        return false ;
+      }
+    }
+    for (const auto & event : wanted) {
+      req.session->subscriptions.insert (event) ;
+    }
+    result = QJsonArray::fromStringList (QStringList (req.session->subscriptions.values ())) ;
+    return true ;
+  }) ;
+
+  add_command ("unsubscribe", "unsubscribe <event|all>...", [] (R req, V result) {
+    if (req.args.contains ("all")) {
+      req.session->subscriptions.clear () ;
+    } else {
+      for (const auto & event : req.args) {
+        req.session->subscriptions.remove (event) ;
+      }
+    }
+    result = QJsonArray::fromStringList (QStringList (req.session->subscriptions.values ())) ;
+    return true ;
+  }) ;
+
+  add_command ("begin", "begin  (opens a batch spanning several reads)", [] (R req, V result) {
+    req.session->open_batches++ ;
+    app->begin_batch () ;
+    result = true ;
+    return true ;
+  }) ;
+
+  add_command ("end", "end  (closes a batch opened by begin)", [] (R req, V result) {
+    // only the session's own, another client's batch stays open
+    if (req.session->open_batches == 0) {
+      result = QString ("no batch open") ;
+      return false ;
+    }
+    req.session->open_batches-- ;
+    app->end_batch () ;
+    result = true ;
+    return true ;
+  }) ;
+}
@@ -0,0 +1,186 @@
+#include "Application.hpp"
+#include "ContextSwitcher.hpp"
+
+#include <QVBoxLayout>
+#include <QKeyEvent>
+#include <QFont>
+
+ContextListModel::~ContextListModel () { }
+
+ContextListModel::ContextListModel (QObject * parent) :
+  QAbstractListModel (parent)
+{
+  connect (app, &Application::contexts_reset, this, &ContextListModel::reset) ;
+  connect (app, &Application::context_added, this, &ContextListModel::added) ;
+  connect (app, &Application::context_removed, this, &ContextListModel::removed) ;
+  connect (app, &Application::context_changed, this, &ContextListModel::changed) ;
+  connect (app, &Application::current_context_changed,
+    this, &ContextListModel::current_changed) ;
+
+  reset () ;
+}
+
+int ContextListModel::rowCount (const QModelIndex & parent) const {
+  return parent.isValid () ? 0 : rows.size () ;
+}
+
+QVariant ContextListModel::data (const QModelIndex & index, int role) const {
+  if (! index.isValid () || index.row () >= rows.size ()) { return QVariant () ; }
+
+  auto ctx = rows.at (index.row ()) ;
+  switch (role) {
+    case Qt::DisplayRole :
+      return QString ("%1: %2 (%3/%4)")
+        .arg (ctx->id.toString ().mid (1, 5))
+        .arg (ctx->dir.dirName ())
+        .arg (ctx->current_image_index)
+        .arg (ctx->images.size ()) ;
+    case Qt::ToolTipRole :
+      return ctx->dir.absolutePath () ;
+    case Qt::FontRole : {
+      QFont font ;
+      font.setBold (ctx->id == current_id) ;
+      return font ;
+    }
+    case IdRole :
+      return QVariant (ctx->id) ;
+    default :
+      return QVariant () ;
+  }
+}
+
+void ContextListModel::reset () {
+  beginResetModel () ;
+  rows = app->all_contexts.toVector () ;
+  current_id = app->current_context ? app->current_context->id : QUuid () ;
+  row_of.clear () ;
+  reindex (0) ;
+  endResetModel () ;
+}
+
+void ContextListModel::added (Application::Context::Ptr ctx) {
+  if (row_of.contains (ctx->id)) { return ; }
+
+  int row = rows.size () ;
+  beginInsertRows (QModelIndex (), row, row) ;
+  rows.push_back (ctx) ;
+  row_of.insert (ctx->id, row) ;
+  endInsertRows () ;
+}
+
+void ContextListModel::removed (QUuid id) {
+  if (! row_of.contains (id)) { return ; }
+
+  int row = row_of.take (id) ;
+  beginRemoveRows (QModelIndex (), row, row) ;
+  rows.remove (row) ;
+  reindex (row) ;
+  endRemoveRows () ;
+}
+
+void ContextListModel::changed (Application::Context::Ptr ctx) {
+  if (! ctx || ! row_of.contains (ctx->id)) { return ; }
+
+  auto idx = index (row_of.value (ctx->id)) ;
+  emit dataChanged (idx, idx) ;
+}
+
+void ContextListModel::current_changed (Application::Context::Ptr ctx) {
+  auto previous = current_id ;
+  current_id = ctx ? ctx->id : QUuid () ;
+
+  for (const auto & id : { previous, current_id }) {
+    if (row_of.contains (id)) {
+      auto idx = index (row_of.value (id)) ;
+      emit dataChanged (idx, idx) ;
+    }
+  }
+}
+
+void ContextListModel::reindex (int from) {
+  for (int i = from ; i < rows.size () ; i++) {
+    row_of[rows.at (i)->id] = i ;
+  }
+}
+
+ContextSwitcher::~ContextSwitcher () { }
+
+ContextSwitcher::ContextSwitcher (QWidget * parent) :
+  QDialog (parent)
+{
+  resize (QSize (360, 420)) ;
+  setModal (true) ;
+
+  auto layout = new QVBoxLayout () ;
+  setLayout (layout) ;
+
+  search = new QLineEdit () ;
+  search->setPlaceholderText ("Search contexts...") ;
+  search->setClearButtonEnabled (true) ;
+  search->installEventFilter (this) ;
+  layout->addWidget (search) ;
+
+  model = new ContextListModel (this) ;
+  proxy = new QSortFilterProxyModel (this) ;
+  proxy->setSourceModel (model) ;
+  proxy->setFilterCaseSensitivity (Qt::CaseInsensitive) ;
+
+  // only the visible rows are ever laid out or painted
+  list = new QListView () ;
+  list->setModel (proxy) ;
+  list->setUniformItemSizes (true) ;
+  list->setLayoutMode (QListView::Batched) ;
+  list->setEditTriggers (QAbstractItemView::NoEditTriggers) ;
+  layout->addWidget (list) ;
+
+  connect (search, &QLineEdit::textChanged,
+    [this] (const QString & text) {
+      proxy->setFilterFixedString (text) ;
+      if (! list->currentIndex ().isValid () && proxy->rowCount () > 0) {
+        list->setCurrentIndex (proxy->index (0, 0)) ;
+      }
+    }) ;
+
+  connect (search, &QLineEdit::returnPressed,
+    [this] () {
+      auto idx = list->currentIndex () ;
+      if (! idx.isValid () && proxy->rowCount () > 0) {
+        idx = proxy->index (0, 0) ;
+      }
+      activate (idx) ;
+    }) ;
+
+  connect (list, &QListView::activated, this, &ContextSwitcher::activate) ;
+
+  setWindowTitle ("Switch Context") ;
+}
+
+void ContextSwitcher::popup () {
+  search->clear () ;
+  if (proxy->rowCount () > 0) {
+    list->setCurrentIndex (proxy->index (0, 0)) ;
+  }
+  show () ;
+  search->setFocus () ;
+}
+
+bool ContextSwitcher::eventFilter (QObject * obj, QEvent * evt) {
+  if (obj == search && evt->type () == QEvent::KeyPress) {
+    auto key = static_cast<QKeyEvent*> (evt)->key () ;
+    if (key == Qt::Key_Up || key == Qt::Key_Down ||
+        key == Qt::Key_PageUp || key == Qt::Key_PageDown) {
+      QCoreApplication::sendEvent (list, evt) ;
+      return true ;
+    }
+  }
+
+  return QDialog::eventFilter (obj, evt) ;
+}
+
+void ContextSwitcher::activate (const QModelIndex & index) {
+  if (index.isValid ()) {
+    auto id = index.data (ContextListModel::IdRole).toUuid () ;
+    accept () ;
+    app->on_context_selection (id) ;
+  }
+}
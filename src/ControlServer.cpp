@@ -0,0 +1,102 @@
+#include "ControlServer.hpp"
+
+#include <iostream>
+
+using std::cerr ;
+using std::endl ;
+
+// a client that stops reading only loses events, never replies
+static const qint64 max_event_backlog = 8 << 20 ;
+
+class ControlServer::Client : public CommandProcessor::Session {
+  public :
+
+  Client (QLocalSocket * socket) : socket (socket), replying (false) { }
+
+  virtual void send (const QByteArray & line) {
+    if (! replying && socket->bytesToWrite () > max_event_backlog) { return ; }
+    socket->write (line) ;
+    socket->write ("\n", 1) ;
+  }
+
+  QLocalSocket * socket ;
+  LineBuffer buffer ;
+  bool replying ;
+} ;
+
+ControlServer::~ControlServer () {
+  for (auto iter = clients.begin () ; iter != clients.end () ; iter++) {
+    // its disconnected signal must not come back to a half destroyed server
+    iter.key ()->disconnect (this) ;
+    iter.key ()->abort () ;
+    commands->remove_session (iter.value ()) ;
+    delete iter.value () ;
+  }
+  clients.clear () ;
+}
+
+ControlServer::ControlServer (CommandProcessor * commands, QObject * parent)
+  : QObject (parent)
+  , commands (commands)
+  , server (new QLocalServer (this))
+{
+  connect (server, &QLocalServer::newConnection,
+    this, &ControlServer::on_connection) ;
+}
+
+bool ControlServer::listen (const QString & name) {
+  // a crashed instance may have left its socket file behind
+  QLocalServer::removeServer (name) ;
+  server->setSocketOptions (QLocalServer::UserAccessOption) ;
+
+  if (! server->listen (name)) {
+    cerr << "control server : " << server->errorString ().toStdString () << endl ;
+    return false ;
+  }
+
+  cerr << "control server listening on "
+       << server->fullServerName ().toStdString () << endl ;
+  return true ;
+}
+
+QString ControlServer::serverName () const {
+  return server->fullServerName () ;
+}
+
+void ControlServer::on_connection () {
+  while (server->hasPendingConnections ()) {
+    auto socket = server->nextPendingConnection () ;
+    auto client = new Client (socket) ;
+    clients.insert (socket, client) ;
+    commands->add_session (client) ;
+
+    connect (socket, &QLocalSocket::readyRead, this,
+      [this, socket] () { on_ready_read (socket) ; }) ;
+    connect (socket, &QLocalSocket::disconnected, this,
+      [this, socket] () { on_disconnected (socket) ; }) ;
+  }
+}
+
+void ControlServer::on_ready_read (QLocalSocket * socket) {
+  auto client = clients.value (socket) ;
+  if (! client) { return ; }
+
+  auto data = socket->readAll () ;
+  client->buffer.feed (data.constData (), data.size ()) ;
+
+  auto lines = client->buffer.take_lines () ;
+  if (! lines.isEmpty ()) {
+    client->replying = true ;
+    commands->execute_batch (lines, client) ;
+    client->replying = false ;
+  }
+}
+
+void ControlServer::on_disconnected (QLocalSocket * socket) {
+  auto client = clients.take (socket) ;
+  if (client) {
+    commands->remove_session (client) ;
+    delete client ;
+  }
+  socket->deleteLater () ;
+}
@@ -0,0 +1,156 @@
+#include "Exporter.hpp"
+#include "Trace.hpp"
+
+#include <QThreadPool>
+#include <QThread>
+#include <QRunnable>
+#include <QImageReader>
+#include <QPainter>
+#include <QTransform>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QDir>
+
+#include <atomic>
+#include <iostream>
+
+using std::cerr ;
+using std::endl ;
+
+namespace {
+
+struct Progress {
+  std::atomic<int> done { 0 } ;
+  std::atomic<int> failed { 0 } ;
+} ;
+
+class ExportJob : public QRunnable {
+  public :
+
+  ExportJob (const QString & source, const QString & target,
+    const Application::ImageState & state, QSize canvas, Progress & progress)
+    : source (source), target (target), state (state)
+    , canvas (canvas), progress (progress)
+  { }
+
+  virtual void run () {
+    TRACE_SCOPE ("export_image") ;
+    QImageReader reader (source) ;
+    auto image = reader.read () ;
+
+    bool ok = false ;
+    if (image.isNull ()) {
+      cerr << "export : cannot read " << source.toStdString ()
+           << " : " << reader.errorString ().toStdString () << endl ;
+    } else {
+      ok = Exporter::render (image, state, canvas).save (target) ;
+      if (! ok) {
+        cerr << "export : cannot write " << target.toStdString () << endl ;
+      }
+    }
+
+    if (! ok) { progress.failed++ ; }
+    progress.done++ ;
+  }
+
+  QString source ;
+  QString target ;
+  Application::ImageState state ;
+  QSize canvas ;
+  Progress & progress ;
+} ;
+
+}
+
+Exporter::~Exporter () { }
+
+Exporter::Exporter (const QString & out_dir, const QString & format,
+  QSize canvas, int jobs)
+:
+  out_dir (out_dir),
+  format (format),
+  canvas (canvas),
+  jobs (jobs > 0 ? jobs : QThread::idealThreadCount ())
+{ }
+
+QImage Exporter::render (const QImage & source,
+  const Application::ImageState & state, QSize canvas)
+{
+  // same chain as the view : the item sits at (x, y) inside the rotscale
+  // group (centered while pristine), and the group is rotated and scaled
+  // around its origin, which the view keeps in the middle of the viewport
+  auto image = state.mirrored ? source.mirrored (true, false) : source ;
+  QPointF pos = state.pristine
+    ? QPointF (- image.width () / 2.0, - image.height () / 2.0)
+    : QPointF (state.x, state.y) ;
+
+  QTransform transform ;
+  transform.rotate (state.rot) ;
+  transform.scale (state.scale (), state.scale ()) ;
+
+  QImage out ;
+  QPointF origin ;
+  if (canvas.isValid ()) {
+    out = QImage (canvas, QImage::Format_ARGB32_Premultiplied) ;
+    out.fill (Qt::black) ;
+    origin = QPointF (canvas.width () / 2.0, canvas.height () / 2.0) ;
+  } else {
+    auto bounds = transform.mapRect (QRectF (pos, image.size ())) ;
+    out = QImage (bounds.size ().toSize ().expandedTo (QSize (1, 1)),
+      QImage::Format_ARGB32_Premultiplied) ;
+    out.fill (Qt::transparent) ;
+    origin = - bounds.topLeft () ;
+  }
+
+  QPainter painter (&out) ;
+  painter.setRenderHints (QPainter::Antialiasing | QPainter::SmoothPixmapTransform) ;
+  painter.translate (origin) ;
+  painter.setTransform (transform, true) ;
+  painter.drawImage (pos, image) ;
+  painter.end () ;
+
+  return out ;
+}
+
+int Exporter::run (Application::Context::Ptr ctx) {
+  QDir out (out_dir) ;
+  if (! out.mkpath (".")) {
+    cerr << "export : cannot create " << out_dir.toStdString () << endl ;
+    return ctx->images.size () ;
+  }
+
+  QThreadPool pool ;
+  pool.setMaxThreadCount (jobs) ;
+  Progress progress ;
+
+  QElapsedTimer timer ;
+  timer.start () ;
+
+  auto total = ctx->images.size () ;
+  auto width = QString::number (total).size () ;
+
+  FilenameStore::Cursor cursor (ctx->images) ;
+  while (cursor.next ()) {
+    auto index = cursor.index () ;
+    auto name = cursor.name () ;
+    auto target = out.absoluteFilePath (
+      QString ("%1_%2.%3")
+        .arg (index, width, 10, QChar ('0'))
+        .arg (QFileInfo (name).completeBaseName ())
+        .arg (format)) ;
+
+    auto job = new ExportJob (ctx->dir.absoluteFilePath (name), target,
+      ctx->effective_state (index), canvas, progress) ;
+    pool.start (job) ;
+  }
+
+  while (! pool.waitForDone (1000)) {
+    cerr << "export : " << progress.done.load () << "/" << total << "\r" << std::flush ;
+  }
+
+  cerr << "export : " << progress.done.load () << "/" << total
+       << " images in " << timer.elapsed () << " ms, "
+       << progress.failed.load () << " failed" << endl ;
+
+  return progress.failed.load () ;
+}
@@ -0,0 +1,111 @@
+#include "FilenameStore.hpp"
+
+static void put_varint (QByteArray & out, quint32 value) {
+  while (value >= 0x80) {
+    out.append (static_cast<char> ((value & 0x7f) | 0x80)) ;
+    value >>= 7 ;
+  }
+  out.append (static_cast<char> (value)) ;
+}
+
+static quint32 get_varint (const char * data, int & offset) {
+  quint32 value = 0 ;
+  int shift = 0 ;
+  while (true) {
+    auto byte = static_cast<quint8> (data[offset++]) ;
+    value |= static_cast<quint32> (byte & 0x7f) << shift ;
+    if (! (byte & 0x80)) { break ; }
+    shift += 7 ;
+  }
+  return value ;
+}
+
+FilenameStore::~FilenameStore () { }
+
+FilenameStore::FilenameStore () : num_names (0) { }
+
+int FilenameStore::size () const { return num_names ; }
+
+bool FilenameStore::isEmpty () const { return num_names == 0 ; }
+
+void FilenameStore::clear () {
+  data.clear () ;
+  bucket_offsets.clear () ;
+  last_name.clear () ;
+  num_names = 0 ;
+}
+
+void FilenameStore::append (const QString & name) {
+  auto utf8 = name.toUtf8 () ;
+
+  int prefix = 0 ;
+  if (num_names % bucket_size == 0) {
+    bucket_offsets.push_back (static_cast<quint32> (data.size ())) ;
+  } else {
+    int limit = qMin (utf8.size (), last_name.size ()) ;
+    while (prefix < limit && utf8.at (prefix) == last_name.at (prefix)) {
+      prefix++ ;
+    }
+  }
+
+  put_varint (data, static_cast<quint32> (prefix)) ;
+  put_varint (data, static_cast<quint32> (utf8.size () - prefix)) ;
+  data.append (utf8.constData () + prefix, utf8.size () - prefix) ;
+
+  last_name = utf8 ;
+  num_names++ ;
+}
+
+void FilenameStore::push_back (const QString & name) { append (name) ; }
+
+FilenameStore & FilenameStore::operator << (const QString & name) {
+  append (name) ;
+  return *this ;
+}
+
+int FilenameStore::decode (int offset, QByteArray & name) const {
+  auto raw = data.constData () ;
+  int prefix = static_cast<int> (get_varint (raw, offset)) ;
+  int length = static_cast<int> (get_varint (raw, offset)) ;
+  name.resize (prefix) ;
+  name.append (raw + offset, length) ;
+  return offset + length ;
+}
+
+QString FilenameStore::at (int index) const {
+  if (index < 0 || index >= num_names) { return QString () ; }
+
+  QByteArray name ;
+  int offset = static_cast<int> (bucket_offsets.at (index / bucket_size)) ;
+  for (int i = 0 ; i <= index % bucket_size ; i++) {
+    offset = decode (offset, name) ;
+  }
+
+  return QString::fromUtf8 (name) ;
+}
+
+QString FilenameStore::operator [] (int index) const { return at (index) ; }
+
+qint64 FilenameStore::bytes () const {
+  return data.capacity () + last_name.capacity ()
+    + bucket_offsets.capacity () * static_cast<qint64> (sizeof (quint32)) ;
+}
+
+FilenameStore::Cursor::Cursor (const FilenameStore & store)
+  : store (store)
+  , current (-1)
+  , offset (0)
+{ }
+
+bool FilenameStore::Cursor::next () {
+  if (current + 1 >= store.num_names) { return false ; }
+  current++ ;
+  offset = store.decode (offset, buffer) ;
+  return true ;
+}
+
+int FilenameStore::Cursor::index () const { return current ; }
+
+const QByteArray & FilenameStore::Cursor::utf8 () const { return buffer ; }
+
+QString FilenameStore::Cursor::name () const { return QString::fromUtf8 (buffer) ; }
@@ -0,0 +1,77 @@
+#include "Filters.hpp"
+#include "Kernels.hpp"
+#include "Trace.hpp"
+
+#include <QColor>
+
+static const char * value_names [] = {
+  "none", "grayscale", "notan2", "notan3", "notan5"
+} ;
+
+const char * Filters::value_name (Value value) {
+  return value < value_count ? value_names [value] : "none" ;
+}
+
+bool Filters::value_from_name (const QString & name, Value & value) {
+  for (int i = 0 ; i < value_count ; i++) {
+    if (name == value_names [i]) {
+      value = static_cast<Value> (i) ;
+      return true ;
+    }
+  }
+  return false ;
+}
+
+int Filters::source_level (const Spec & spec, const QSize & size, int n) {
+  // down to radii of 4 to 8 pixels, which three box passes still render
+  // smoothly, but not below the smallest level the cache builds
+  const int min_side = 64 ;
+  while ((spec.blur >> n) >= 8 && qMin (size.width (), size.height ()) >> (n + 1) >= min_side) {
+    n++ ;
+  }
+  return n ;
+}
+
+QImage Filters::apply (const QImage & image, const Spec & spec, int n) {
+  if (spec.tag () == 0 || image.isNull ()) { return image ; }
+
+  TRACE_SCOPE ("filter") ;
+  auto radius = (spec.blur + (1 << n) / 2) >> n ;
+  auto blurred = Kernels::box_blur (image, radius) ;
+  if (spec.value == none) { return blurred ; }
+
+  auto gray = Kernels::luminance (blurred) ;
+  switch (spec.value) {
+    case notan2 : return Kernels::posterize (gray, 2) ;
+    case notan3 : return Kernels::posterize (gray, 3) ;
+    case notan5 : return Kernels::posterize (gray, 5) ;
+    default : return gray ;
+  }
+}
+
+QImage Filters::edges (const QImage & magnitude, int threshold) {
+  if (magnitude.isNull ()) { return QImage () ; }
+
+  TRACE_SCOPE ("edges") ;
+  // premultiplied, the magnitude is the alpha ; below the threshold is
+  // transparent
+  const QColor color (0, 230, 255) ;
+  quint32 lut [256] ;
+  for (int m = 0 ; m < 256 ; m++) {
+    lut [m] = m < threshold ? 0 :
+      qRgba ((color.red () * m + 127) / 255, (color.green () * m + 127) / 255,
+             (color.blue () * m + 127) / 255, m) ;
+  }
+
+  QImage overlay (magnitude.size (), QImage::Format_ARGB32_Premultiplied) ;
+  auto bits = overlay.bits () ;
+  int stride = overlay.bytesPerLine (), width = magnitude.width () ;
+  Kernels::for_rows (magnitude.height (), [&] (int begin, int end) {
+    for (int y = begin ; y < end ; y++) {
+      auto in = magnitude.constScanLine (y) ;
+      auto out = reinterpret_cast<quint32 *> (bits + y * stride) ;
+      for (int x = 0 ; x < width ; x++) { out[x] = lut [in[x]] ; }
+    }
+  }) ;
+  return overlay ;
+}
@@ -1,9 +1,20 @@
 #include "Application.hpp"
 #include "GraphicsView.hpp"
+#include "Trace.hpp"
+#include "ImageCache.hpp"
+#include "Kernels.hpp"
 
 #include <QGraphicsScene>
 #include <QRadialGradient>
 #include <QClipboard>
+#include <QImageReader>
+#include <QElapsedTimer>
+#include <QBuffer>
+#include <QFile>
+#include <QPainter>
+#include <QTransform>
+#include <QFontDatabase>
+#include <QStringList>
 
 #include <iostream>
 
@@ -11,13 +22,27 @@ using std::cerr ;
 using std::endl ;
 using std::cout ;
 
-GraphicsView::~GraphicsView () { }
+GraphicsView::~GraphicsView () {
+  if (app->active_view == this) { app->active_view = nullptr ; }
+  account (0, 0) ;
+}
 
 GraphicsView::GraphicsView (QWidget* parent)
     : QGraphicsView (parent)
     , img_item (nullptr)
     , img_mirrored_item (nullptr)
     , rotscale_item (nullptr)
+    , edge_item (nullptr)
+    , edge_mirrored_item (nullptr)
+    , compare_item (nullptr)
+    , compare_mirrored_item (nullptr)
+    , shown_level (0)
+    , last_refresh { 0, 0, 0 }
+    , show_perf (false)
+    , compare_uploaded (0)
+    , compare_grabbed (false)
+    , pixel_bytes (0)
+    , mirrored_bytes (0)
 {
 
   //resize (sizeHint ()) ;
@@ -54,20 +79,21 @@ GraphicsView::GraphicsView (QWidget* parent)
 
   connect (app, &Application::img_translate,
     [this] (double dx, double dy) {
-      if (img_item) {
-        auto p1 = img_item->mapToScene (img_item->pos ()) ;
+      if (img_item && active ()) {
+        // in the group's coordinates, the items themselves are scaled
+        // when drawn from a pyramid level
+        auto p1 = rotscale_item->mapToScene (img_item->pos ()) ;
         auto p2 = QPointF (p1.x() + dx, p1.y() + dy) ;
-        img_item->setPos (img_item->mapFromScene (p2)) ;
-        img_mirrored_item->setPos (img_item->mapFromScene (p2)) ;
+        img_item->setPos (rotscale_item->mapFromScene (p2)) ;
+        img_mirrored_item->setPos (rotscale_item->mapFromScene (p2)) ;
         auto pos = img_item->pos () ;
-        auto size = img_item->boundingRect () ;
         app->save_xy (pos.x (), pos.y ()) ;
       }
     }) ;
 
   connect (app, &Application::img_locate,
     [this] (double x, double y) {
-      if (img_item) {
+      if (img_item && active ()) {
         img_item->setPos (x, y) ;
         img_mirrored_item->setPos (x, y) ;
       }
@@ -75,8 +101,12 @@ GraphicsView::GraphicsView (QWidget* parent)
 
   connect(app, &Application::img_copy,
       [this]() {
-        if(img_item) {
-          copied_image = img_item->pixmap().toImage();
+        if(img_item && active ()) {
+          // full resolution, whatever level is on screen ; not through the
+          // cache, which would blur a deeper level for a large radius
+          copied_image = app->view_filter.tag () == 0
+            ? shown_image : Filters::apply (shown_image, app->view_filter, 0) ;
+          app->mem.set (MemStats::clipboard, MemStats::bytes_of (copied_image)) ;
           if(not copied_image.isNull()) {
             auto clipboard = QGuiApplication::clipboard();
             clipboard->setImage(copied_image);
@@ -87,21 +117,32 @@ GraphicsView::GraphicsView (QWidget* parent)
 
   connect (app, &Application::img_scale,
     [this] (double scale) {
-      if (img_item) {
+      if (img_item && active ()) {
         rotscale_item->setScale (scale) ;
+        auto level = ImageCache::level_for (shown_image.size (), scale) ;
+        if (level != shown_level) { show_level (level) ; }
       }
     }) ;
 
+  connect (app, &Application::view_filter_changed,
+    [this] () { show_level (shown_level) ; }) ;
+
+  connect (app, &Application::edges_changed,
+    this, &GraphicsView::show_edges) ;
+
+  connect (app, &Application::compare_changed,
+    this, &GraphicsView::show_compare) ;
+
   connect (app, &Application::img_rotate,
     [this] (double value) {
-      if (img_item) {
+      if (img_item && active ()) {
         rotscale_item->setRotation (value) ;
       }
     }) ;
 
   connect (app, &Application::img_mirror,
     [this] (bool value) {
-      if (img_item && img_mirrored_item) {
+      if (img_item && img_mirrored_item && active ()) {
         img_item->setVisible (!value) ;
         img_mirrored_item->setVisible (value) ;
       }
@@ -112,6 +153,14 @@ GraphicsView::GraphicsView (QWidget* parent)
 }
 
 void GraphicsView::context_refresh (Application::Context::Ptr ctx) {
+  // the others keep what they show ; under the board nothing shows, the
+  // board refreshes the view when it leaves
+  if (! active () || app->board) { return ; }
+  TRACE_SCOPE ("context_refresh") ;
+
+  // context switches and new folders get measured too
+  if (! app->perf.active ()) { app->perf.begin () ; }
+
   if (img_item) {
     scene->removeItem (img_item) ;
     delete img_item ;
@@ -124,8 +173,19 @@ void GraphicsView::context_refresh (Application::Context::Ptr ctx) {
       delete img_mirrored_item ;
       img_mirrored_item = nullptr ;
     }
+    // went with their parents
+    edge_item = nullptr ;
+    edge_mirrored_item = nullptr ;
+    compare_item = nullptr ;
+    compare_mirrored_item = nullptr ;
+    compare_fitted = QImage () ;
+    compare_uploaded = 0 ;
   }
 
+  account (0, 0) ;
+  shown_file.clear () ;
+  shown_image = QImage () ;
+
   if (! ctx) {
     emit log_no_context () ;
     return ;
@@ -135,20 +195,53 @@ void GraphicsView::context_refresh (Application::Context::Ptr ctx) {
     auto img_file = ctx->dir.absoluteFilePath (
       ctx->images[ctx->current_image_index]) ;
 
-    auto pix = QPixmap (img_file) ;
-    auto pix_mirrored =
-      QPixmap::fromImage (pix.toImage ().mirrored (true, false)) ;
+    QElapsedTimer timer ;
+    timer.start () ;
+
+    // a prefetched image skips both read and decode, one still being
+    // decoded is waited for and shows up as read time
+    QImage image = app->cache->get (img_file) ;
+    bool cached = ! image.isNull () ;
+
+    // read the whole file first, so slow storage shows apart from decoding
+    QByteArray data ;
+    if (! cached) {
+      TRACE_SCOPE ("read") ;
+      QFile file (img_file) ;
+      if (file.open (QIODevice::ReadOnly)) { data = file.readAll () ; }
+    }
+    last_refresh.read = timer.nsecsElapsed () ;
+    app->perf.mark (PerfStats::read) ;
+
+    if (! cached) {
+      TRACE_SCOPE ("decode") ;
+      QBuffer buffer (&data) ;
+      image = QImageReader (&buffer).read () ;
+      // back-n-forth comes straight back to it
+      app->cache->insert (img_file, image) ;
+    }
+    shown_file = img_file ;
+    shown_image = image ;
+
+    // the level and filter count as decoding, both are cached
+    auto scale = app->current_state ? app->current_state->scale () : 1.0 ;
+    shown_level = ImageCache::level_for (image.size (), scale) ;
+    auto shown = app->cache->view (img_file, image, shown_level, app->view_filter) ;
+    last_refresh.decode = timer.nsecsElapsed () - last_refresh.read ;
+    app->perf.mark (PerfStats::decode) ;
+
+    upload (shown) ;
+    last_refresh.upload = timer.nsecsElapsed () - last_refresh.read - last_refresh.decode ;
+    app->perf.mark (PerfStats::upload) ;
 
-    img_item = new QGraphicsPixmapItem (pix, rotscale_item) ;
-    img_mirrored_item = new QGraphicsPixmapItem (pix_mirrored, rotscale_item) ;
-    img_item->setTransformationMode(Qt::SmoothTransformation);
-    img_mirrored_item->setTransformationMode(Qt::SmoothTransformation);
     //img_item = scene->addPixmap (img_file) ;
-    auto size = img_item->boundingRect () ;
+    QSizeF size = image.size () ;
 
     img_item->setPos (- size.width () / 2, - size.height () / 2) ;
     img_mirrored_item->setPos (- size.width () / 2, - size.height () / 2) ;
     img_mirrored_item->setVisible (false) ;
+    show_edges () ;
+    show_compare () ;
 
     emit log_image_index (ctx->current_image_index, ctx->images.size () - 1) ;
   } else {
@@ -156,6 +249,260 @@ void GraphicsView::context_refresh (Application::Context::Ptr ctx) {
   }
 }
 
+void GraphicsView::show_level (int level) {
+  if (! img_item || shown_image.isNull ()) { return ; }
+
+  shown_level = level ;
+  upload (app->cache->view (shown_file, shown_image, level, app->view_filter)) ;
+  show_edges () ;
+  show_compare () ;
+}
+
+void GraphicsView::show_edges () {
+  if (! img_item) { return ; }
+
+  if (app->edge_threshold == 0 || shown_image.isNull ()) {
+    delete edge_item ;
+    delete edge_mirrored_item ;
+    edge_item = nullptr ;
+    edge_mirrored_item = nullptr ;
+    return ;
+  }
+
+  // from the level on show, whatever the view filter does to it
+  auto overlay = app->cache->edges (shown_file, shown_image, shown_level, app->edge_threshold) ;
+  if (! edge_item) {
+    // the parents' level scale, position and mirroring apply as they are
+    edge_item = new QGraphicsPixmapItem (img_item) ;
+    edge_mirrored_item = new QGraphicsPixmapItem (img_mirrored_item) ;
+    // above the comparison
+    edge_item->setZValue (1) ;
+    edge_mirrored_item->setZValue (1) ;
+    edge_item->setTransformationMode (Qt::SmoothTransformation) ;
+    edge_mirrored_item->setTransformationMode (Qt::SmoothTransformation) ;
+  }
+  TRACE_SCOPE ("upload") ;
+  edge_item->setPixmap (QPixmap::fromImage (overlay)) ;
+  edge_mirrored_item->setPixmap (QPixmap::fromImage (overlay.mirrored (true, false))) ;
+  edge_item->setTransform (overlay_transform (overlay.size ())) ;
+  edge_mirrored_item->setTransform (overlay_transform (overlay.size ())) ;
+}
+
+void GraphicsView::show_compare () {
+  // every view, like the edges and the filter, or an inactive one would
+  // keep a comparison that changed or went away
+  if (! img_item) { return ; }
+
+  const auto & compare = app->compare ;
+  if (compare.file != compare_file) {
+    compare_file = compare.file ;
+    compare_image = QImage () ;
+    compare_fitted = QImage () ;
+    compare_uploaded = 0 ;
+    if (! compare_file.isEmpty ()) {
+      compare_image = app->cache->get (compare_file) ;
+      if (compare_image.isNull ()) {
+        compare_image = ImageCache::decode (compare_file) ;
+        app->cache->insert (compare_file, compare_image) ;
+      }
+      if (compare_image.isNull ()) {
+        cerr << "Error reading " << compare_file.toStdString () << endl ;
+      }
+    }
+  }
+
+  if (compare_image.isNull () || shown_image.isNull ()) {
+    delete compare_item ;
+    delete compare_mirrored_item ;
+    compare_item = nullptr ;
+    compare_mirrored_item = nullptr ;
+    return ;
+  }
+
+  // compared with the level on show, unfiltered, at its resolution
+  auto reference = app->cache->level (shown_file, shown_image, shown_level) ;
+  auto fitted = compare_image.size ().scaled (reference.size (), Qt::KeepAspectRatio) ;
+  if (fitted.isEmpty ()) { return ; }
+  if (compare_fitted.size () != fitted) {
+    TRACE_SCOPE ("compare_fit") ;
+    // resampled from its own pyramid, the smallest level still larger
+    int m = 0 ;
+    while (compare_image.width () >> (m + 1) >= fitted.width ()
+      && compare_image.height () >> (m + 1) >= fitted.height ())
+    {
+      m++ ;
+    }
+    compare_fitted = Kernels::to_32bit (app->cache->level (compare_file, compare_image, m)
+      .scaled (fitted, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)) ;
+    compare_uploaded = 0 ;
+  }
+
+  if (! compare_item) {
+    compare_item = new QGraphicsPixmapItem (img_item) ;
+    compare_mirrored_item = new QGraphicsPixmapItem (img_mirrored_item) ;
+    compare_item->setTransformationMode (Qt::SmoothTransformation) ;
+    compare_mirrored_item->setTransformationMode (Qt::SmoothTransformation) ;
+  }
+
+  // centred, then moved by the offset, scaled down to the level
+  auto to_level = qreal (reference.width ()) / shown_image.width () ;
+  QPointF origin ((reference.width () - fitted.width ()) / 2.0 + compare.x * to_level,
+                  (reference.height () - fitted.height ()) / 2.0 + compare.y * to_level) ;
+
+  QTransform place ;
+  if (compare.difference) {
+    // recomputed on every move, which the kernel keeps interactive
+    QImage difference ;
+    {
+      TRACE_SCOPE ("difference") ;
+      difference = Kernels::difference (reference, compare_fitted, origin.toPoint ()) ;
+    }
+    TRACE_SCOPE ("upload") ;
+    compare_item->setPixmap (QPixmap::fromImage (difference)) ;
+    compare_mirrored_item->setPixmap (compare_item->pixmap ()) ;
+    compare_uploaded = 0 ;
+  } else {
+    if (compare_uploaded != compare_fitted.cacheKey ()) {
+      TRACE_SCOPE ("upload") ;
+      compare_item->setPixmap (QPixmap::fromImage (compare_fitted)) ;
+      compare_mirrored_item->setPixmap (compare_item->pixmap ()) ;
+      compare_uploaded = compare_fitted.cacheKey () ;
+    }
+    place.translate (origin.x (), origin.y ()) ;
+  }
+  place *= overlay_transform (reference.size ()) ;
+
+  // one pixmap for both, the mirrored parent has its pixels flipped
+  auto width = img_mirrored_item->pixmap ().width () ;
+  compare_item->setTransform (place) ;
+  compare_mirrored_item->setTransform (place * QTransform (-1, 0, 0, 1, width, 0)) ;
+  compare_item->setOpacity (compare.opacity / 100.0) ;
+  compare_mirrored_item->setOpacity (compare.opacity / 100.0) ;
+}
+
+QPointF GraphicsView::image_point (const QPoint & pos) const {
+  auto p = img_item->mapFromScene (mapToScene (pos)) ;
+  // back to full image pixels from the level's
+  p = img_item->transform ().map (p) ;
+  if (img_mirrored_item->isVisible ()) { p.setX (- p.x ()) ; }
+  return p ;
+}
+
+QTransform GraphicsView::overlay_transform (const QSize & size) const {
+  auto pix = img_item->pixmap ().size () ;
+  if (size.isEmpty () || pix.isEmpty ()) { return QTransform () ; }
+  return QTransform::fromScale (qreal (pix.width ()) / size.width (),
+                                qreal (pix.height ()) / size.height ()) ;
+}
+
+void GraphicsView::account (qint64 pixels, qint64 mirrored) {
+  app->mem.add (MemStats::pixels, pixels - pixel_bytes) ;
+  app->mem.add (MemStats::mirrored, mirrored - mirrored_bytes) ;
+  pixel_bytes = pixels ;
+  mirrored_bytes = mirrored ;
+}
+
+void GraphicsView::upload (const QImage & image) {
+  QPixmap pix, pix_mirrored ;
+  {
+    TRACE_SCOPE ("upload") ;
+    pix = QPixmap::fromImage (image) ;
+    pix_mirrored = QPixmap::fromImage (image.mirrored (true, false)) ;
+  }
+  account (MemStats::bytes_of (pix), MemStats::bytes_of (pix_mirrored)) ;
+
+  if (! img_item) {
+    img_item = new QGraphicsPixmapItem (rotscale_item) ;
+    img_mirrored_item = new QGraphicsPixmapItem (rotscale_item) ;
+    img_item->setTransformationMode(Qt::SmoothTransformation);
+    img_mirrored_item->setTransformationMode(Qt::SmoothTransformation);
+  }
+  img_item->setPixmap (pix) ;
+  img_mirrored_item->setPixmap (pix_mirrored) ;
+
+  // a level covers the same area as the full image
+  QTransform transform ;
+  if (! image.isNull ()) {
+    transform.scale (qreal (shown_image.width ()) / image.width (),
+                     qreal (shown_image.height ()) / image.height ()) ;
+  }
+  img_item->setTransform (transform) ;
+  img_mirrored_item->setTransform (transform) ;
+}
+
+bool GraphicsView::active () const {
+  return ! app->active_view || app->active_view == this ;
+}
+
+void GraphicsView::focusInEvent (QFocusEvent* evt) {
+  QGraphicsView::focusInEvent (evt) ;
+  if (! active ()) { emit focused () ; }
+}
+
+void GraphicsView::set_perf_overlay (bool visible) {
+  show_perf = visible ;
+  viewport ()->update () ;
+}
+
+void GraphicsView::paintEvent (QPaintEvent* evt) {
+  app->perf.mark (PerfStats::scene) ;
+  {
+    TRACE_SCOPE ("paint") ;
+    QGraphicsView::paintEvent (evt) ;
+  }
+
+  if (app->perf.finish ()) {
+    emit switch_painted () ;
+    // this paint drew the previous numbers
+    if (show_perf) { viewport ()->update () ; }
+  }
+}
+
+void GraphicsView::drawForeground (QPainter* painter, const QRectF & rect) {
+  QGraphicsView::drawForeground (painter, rect) ;
+  if (! show_perf) { return ; }
+
+  const auto & perf = app->perf ;
+  auto ms = [] (qint64 ns) { return QString::number (ns / 1e6, 'f', 2) ; } ;
+
+  QStringList lines ;
+  lines << QString ("%1 %2 %3 %4 %5")
+    .arg ("stage", -7).arg ("last", 8).arg ("p50", 8).arg ("p95", 8).arg ("max", 8) ;
+  for (int i = 0 ; i < PerfStats::stage_count ; i++) {
+    const auto & h = perf.histogram (i) ;
+    lines << QString ("%1 %2 %3 %4 %5")
+      .arg (PerfStats::stage_name (i), -7)
+      .arg (ms (perf.last (i)), 8)
+      .arg (ms (h.percentile (0.50)), 8)
+      .arg (ms (h.percentile (0.95)), 8)
+      .arg (ms (h.max ()), 8) ;
+  }
+  lines << QString ("%1 switches, ms").arg (perf.switches ()) ;
+
+  painter->save () ;
+  // viewport coordinates, the overlay does not follow the image
+  painter->resetTransform () ;
+  auto font = QFontDatabase::systemFont (QFontDatabase::FixedFont) ;
+  painter->setFont (font) ;
+
+  QFontMetrics metrics (font) ;
+  int line_height = metrics.lineSpacing () ;
+  int width = 0 ;
+  for (const auto & line : lines) {
+    width = qMax (width, metrics.boundingRect (line).width ()) ;
+  }
+
+  QRect box (8, 8, width + 16, line_height * lines.size () + 12) ;
+  painter->fillRect (box, QColor (0, 0, 0, 170)) ;
+  painter->setPen (Qt::green) ;
+  int y = box.top () + 6 + metrics.ascent () ;
+  for (const auto & line : lines) {
+    painter->drawText (box.left () + 8, y, line) ;
+    y += line_height ;
+  }
+  painter->restore () ;
+}
+
 QSize GraphicsView::sizeHint () {
   return QSize (800, 600) ;
 }
@@ -165,6 +512,15 @@ QSizePolicy GraphicsView::sizePolicy () {
 }
 
 void GraphicsView::mousePressEvent (QMouseEvent* evt) {
+  if (evt->button () == Qt::LeftButton && evt->modifiers ().testFlag (Qt::ShiftModifier)
+    && compare_item)
+  {
+    auto p = image_point (evt->pos ()) ;
+    compare_grab = QPointF (app->compare.x - p.x (), app->compare.y - p.y ()) ;
+    compare_grabbed = true ;
+    return ;
+  }
+
   switch (evt->button ()) {
     case Qt::LeftButton :
       if (evt->modifiers().testFlag(Qt::ControlModifier)) {
@@ -181,6 +537,11 @@ void GraphicsView::mousePressEvent (QMouseEvent* evt) {
 }
 
 void GraphicsView::mouseReleaseEvent (QMouseEvent* evt) {
+  if (compare_grabbed && evt->button () == Qt::LeftButton) {
+    compare_grabbed = false ;
+    return ;
+  }
+
   switch (evt->button ()) {
     case Qt::LeftButton :
       app->move_ungrab (evt->x (), evt->y ()) ;
@@ -193,10 +554,18 @@ void GraphicsView::mouseReleaseEvent (QMouseEvent* evt) {
 }
 
 void GraphicsView::mouseMoveEvent (QMouseEvent* evt) {
+  if (compare_grabbed) {
+    if (! compare_item) { compare_grabbed = false ; return ; }
+    auto p = image_point (evt->pos ()) ;
+    app->on_compare_offset (compare_grab.x () + p.x (), compare_grab.y () + p.y ()) ;
+    return ;
+  }
   app->drag (evt->x (), evt->y ()) ;
 }
 
 void GraphicsView::wheelEvent (QWheelEvent* evt) {
+  // scrolls the view under the pointer
+  if (! active ()) { setFocus (Qt::MouseFocusReason) ; }
   auto dpos = evt->angleDelta () / 4 ;
   app->push_translate (dpos.x (), dpos.y ()) ;
   evt->accept () ;
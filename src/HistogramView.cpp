@@ -0,0 +1,132 @@
+#include "Application.hpp"
+#include "HistogramView.hpp"
+#include "ImageCache.hpp"
+#include "Trace.hpp"
+
+#include <QPainter>
+#include <QPainterPath>
+#include <QRunnable>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+class HistogramJob : public QRunnable {
+  public :
+
+  HistogramJob (HistogramView * view, quint64 generation, const QString & file)
+    : view (view), generation (generation), file (file) { }
+
+  virtual void run () {
+    TRACE_SCOPE ("histogram") ;
+    // waits for the decode the view started, if it is still running
+    auto image = app->cache->get (file) ;
+    if (image.isNull ()) { image = ImageCache::decode (file) ; }
+    if (image.isNull ()) { return ; }
+
+    // about a megapixel counts the same shape as the full image
+    int n = 0 ;
+    while ((qint64 (image.width ()) * image.height () >> (2 * n)) > (1 << 20)
+      && qMin (image.width (), image.height ()) >> (n + 1) >= 64)
+    {
+      n++ ;
+    }
+    auto counts = Kernels::histograms (app->cache->level (file, image, n)) ;
+
+    auto view = this->view ;
+    auto generation = this->generation ;
+    QMetaObject::invokeMethod (view,
+      [view, generation, counts] () { view->finished (generation, counts) ; },
+      Qt::QueuedConnection) ;
+  }
+
+  HistogramView * view ;
+  quint64 generation ;
+  QString file ;
+} ;
+
+}
+
+HistogramView::~HistogramView () {
+  pool.clear () ;
+  pool.waitForDone () ;
+}
+
+HistogramView::HistogramView (QWidget * parent)
+  : QWidget (parent)
+  , active (false)
+  , counted (false)
+  , generation (0)
+{
+  memset (&counts, 0, sizeof (counts)) ;
+  pool.setMaxThreadCount (1) ;
+
+  connect (app, &Application::current_img_changed, this, &HistogramView::image_changed) ;
+  connect (app, &Application::current_context_changed, this, &HistogramView::image_changed) ;
+}
+
+QSize HistogramView::sizeHint () const {
+  return QSize (256, 140) ;
+}
+
+void HistogramView::set_active (bool active) {
+  this->active = active ;
+  if (active) { image_changed () ; }
+}
+
+void HistogramView::image_changed () {
+  generation++ ;
+  counted = false ;
+  update () ;
+
+  auto ctx = app->current_context ;
+  if (! active || ! ctx || ctx->images.size () == 0) { return ; }
+
+  // only the newest request matters, drop what has not started yet
+  pool.clear () ;
+  pool.start (new HistogramJob (this, generation,
+    ctx->dir.absoluteFilePath (ctx->images.at (ctx->current_image_index)))) ;
+}
+
+void HistogramView::finished (quint64 generation, const Kernels::Histograms & counts) {
+  if (generation != this->generation) { return ; }
+  this->counts = counts ;
+  counted = true ;
+  update () ;
+}
+
+void HistogramView::paintEvent (QPaintEvent *) {
+  QPainter painter (this) ;
+  painter.fillRect (rect (), Qt::black) ;
+  if (! counted || counts.pixels == 0) { return ; }
+
+  // scaled to the tallest bin short of the extremes, which clipped
+  // shadows and highlights would otherwise flatten everything against
+  quint32 top = 1 ;
+  for (auto channel : { counts.luma, counts.red, counts.green, counts.blue }) {
+    top = std::max (top, *std::max_element (channel + 1, channel + 255)) ;
+  }
+
+  auto curve = [this, top] (const quint32 * channel) {
+    QPainterPath path ;
+    path.moveTo (0, height ()) ;
+    for (int v = 0 ; v < 256 ; v++) {
+      auto h = std::min (1.0, double (channel[v]) / top) * (height () - 2) ;
+      path.lineTo ((v + 0.5) * width () / 256.0, height () - h) ;
+    }
+    path.lineTo (width (), height ()) ;
+    return path ;
+  } ;
+
+  painter.setRenderHint (QPainter::Antialiasing) ;
+  painter.fillPath (curve (counts.luma), QColor (200, 200, 200, 110)) ;
+  painter.setBrush (Qt::NoBrush) ;
+  painter.setPen (QColor (255, 70, 70)) ;
+  painter.drawPath (curve (counts.red)) ;
+  painter.setPen (QColor (70, 220, 70)) ;
+  painter.drawPath (curve (counts.green)) ;
+  painter.setPen (QColor (90, 140, 255)) ;
+  painter.drawPath (curve (counts.blue)) ;
+}
@@ -0,0 +1,316 @@
+#include "Application.hpp"
+#include "ImageCache.hpp"
+#include "Trace.hpp"
+#include "Kernels.hpp"
+
+#include <QRunnable>
+#include <QImageReader>
+#include <QBuffer>
+#include <QFile>
+#include <QMutexLocker>
+
+namespace {
+
+class DecodeJob : public QRunnable {
+  public :
+
+  DecodeJob (ImageCache * cache, const QString & file, bool decode,
+    double scale, const QSizeF & box, const Filters::Spec & spec, bool background)
+    : cache (cache), file (file), decode (decode), scale (scale), box (box)
+    , spec (spec), background (background) { }
+
+  virtual void run () {
+    TRACE_SCOPE ("prefetch") ;
+    if (background) { cache->started (this) ; }
+    QImage image ;
+    if (decode) {
+      image = ImageCache::decode (file) ;
+      cache->finished (file, image) ;
+    } else {
+      image = cache->get (file) ;
+    }
+    if (image.isNull ()) { return ; }
+
+    // the level depends on the image size, known only now
+    auto fitted = box.isEmpty () ? scale : ImageCache::fit_scale (image.size (), box) ;
+    auto level = ImageCache::level_for (image.size (), fitted) ;
+    if (level > 0 || spec.tag () != 0) { cache->view (file, image, level, spec) ; }
+    emit cache->prepared (file, image.size ()) ;
+  }
+
+  ImageCache * cache ;
+  QString file ;
+  bool decode ;
+  double scale ;
+  QSizeF box ;
+  Filters::Spec spec ;
+  bool background ;
+} ;
+
+}
+
+ImageCache::ImageCache (qint64 budget, QObject * parent)
+  : QObject (parent)
+  , clock (0)
+  , used (0)
+  , budget (budget)
+{
+  // one decode at a time, prefetching must not compete with the gui
+  pool.setMaxThreadCount (1) ;
+}
+
+ImageCache::~ImageCache () {
+  pool.clear () ;
+  pool.waitForDone () ;
+}
+
+QImage ImageCache::decode (const QString & file) {
+  QFile in (file) ;
+  if (! in.open (QIODevice::ReadOnly)) { return QImage () ; }
+  auto data = in.readAll () ;
+
+  QBuffer buffer (&data) ;
+  return QImageReader (&buffer).read () ;
+}
+
+void ImageCache::prefetch (const QString & file, double scale, const Filters::Spec & spec) {
+  schedule (file, scale, QSizeF (), spec, false) ;
+}
+
+void ImageCache::prefetch_background (const QString & file, const QSizeF & box,
+  const Filters::Spec & spec)
+{
+  schedule (file, 1, box, spec, true) ;
+}
+
+void ImageCache::schedule (const QString & file, double scale, const QSizeF & box,
+  const Filters::Spec & spec, bool background)
+{
+  QMutexLocker lock (&mutex) ;
+  bool decode = false ;
+  auto iter = entries.find (Key { file, 0, 0 }) ;
+  if (iter != entries.end ()) {
+    iter->stamp = ++clock ;
+    // one still in flight prepares the view it was asked for
+    if (! iter->ready) { return ; }
+    auto size = iter->image.size () ;
+    auto level = level_for (size, box.isEmpty () ? scale : fit_scale (size, box)) ;
+    if ((level == 0 && spec.tag () == 0) || entries.contains (Key { file, level, spec.tag () })) {
+      // nothing to do, but the caller waits for the signal all the same
+      if (background) { emit prepared (file, size) ; }
+      return ;
+    }
+  } else {
+    entries.insert (Key { file, 0, 0 }, Entry { QImage (), false, ++clock }) ;
+    decode = true ;
+  }
+
+  auto job = new DecodeJob (this, file, decode, scale, box, spec, background) ;
+  // behind every other prefetch, and dropped by cancel_background ()
+  if (background) { waiting << job ; }
+  pool.start (job, background ? -1 : 0) ;
+}
+
+void ImageCache::started (QRunnable * job) {
+  QMutexLocker lock (&mutex) ;
+  waiting.removeOne (job) ;
+}
+
+bool ImageCache::take_waiting (const QString & file) {
+  for (auto job : waiting) {
+    auto decode_job = static_cast<DecodeJob *> (job) ;
+    if (! decode_job->decode || decode_job->file != file) { continue ; }
+
+    // fails once a worker has picked it, it is about to run then
+    if (! pool.tryTake (job)) { return false ; }
+    waiting.removeOne (job) ;
+    delete job ;
+    return true ;
+  }
+  return false ;
+}
+
+void ImageCache::cancel_background () {
+  {
+    QMutexLocker lock (&mutex) ;
+    for (auto job : waiting) {
+      if (! pool.tryTake (job)) { continue ; }
+
+      // its entry would wait for a decode that is not coming
+      auto decode_job = static_cast<DecodeJob *> (job) ;
+      if (decode_job->decode) {
+        auto iter = entries.find (Key { decode_job->file, 0, 0 }) ;
+        if (iter != entries.end () && ! iter->ready) { entries.erase (iter) ; }
+      }
+      delete job ;
+    }
+    waiting.clear () ;
+  }
+  decoded.wakeAll () ;
+}
+
+QImage ImageCache::get (const QString & file) {
+  QMutexLocker lock (&mutex) ;
+
+  Key key { file, 0, 0 } ;
+  auto iter = entries.find (key) ;
+  if (iter == entries.end ()) { return QImage () ; }
+
+  // queued behind background decodes : sooner done here than waited for
+  if (! iter->ready && take_waiting (file)) {
+    lock.unlock () ;
+    auto image = decode (file) ;
+    finished (file, image) ;
+    // the board item that queued it waits for this
+    if (! image.isNull ()) { emit prepared (file, image.size ()) ; }
+    return image ;
+  }
+
+  while (! iter->ready) {
+    decoded.wait (&mutex) ;
+    // the entry may have been cleared meanwhile
+    iter = entries.find (key) ;
+    if (iter == entries.end ()) { return QImage () ; }
+  }
+
+  iter->stamp = ++clock ;
+  return iter->image ;
+}
+
+void ImageCache::insert (const QString & file, const QImage & image) {
+  if (image.isNull ()) { return ; }
+  QMutexLocker lock (&mutex) ;
+  store (Key { file, 0, 0 }, image) ;
+}
+
+void ImageCache::finished (const QString & file, const QImage & image) {
+  {
+    QMutexLocker lock (&mutex) ;
+    Key key { file, 0, 0 } ;
+    auto iter = entries.find (key) ;
+    if (iter != entries.end () && ! iter->ready) {
+      if (image.isNull ()) {
+        entries.erase (iter) ;
+      } else {
+        store (key, image) ;
+      }
+    }
+  }
+  decoded.wakeAll () ;
+}
+
+bool ImageCache::ready (const QString & file) const {
+  QMutexLocker lock (&mutex) ;
+  auto iter = entries.constFind (Key { file, 0, 0 }) ;
+  return iter != entries.constEnd () && iter->ready ;
+}
+
+QImage ImageCache::find (const Key & key) {
+  QMutexLocker lock (&mutex) ;
+  auto iter = entries.find (key) ;
+  if (iter == entries.end () || ! iter->ready) { return QImage () ; }
+  iter->stamp = ++clock ;
+  return iter->image ;
+}
+
+QImage ImageCache::level (const QString & file, const QImage & base, int n) {
+  if (n <= 0) { return base ; }
+
+  auto image = find (Key { file, n, 0 }) ;
+  if (image.isNull ()) {
+    TRACE_SCOPE ("pyramid") ;
+    image = Kernels::halve (level (file, base, n - 1)) ;
+    QMutexLocker lock (&mutex) ;
+    store (Key { file, n, 0 }, image) ;
+  }
+  return image ;
+}
+
+QImage ImageCache::view (const QString & file, const QImage & base, int n, const Filters::Spec & spec) {
+  if (spec.tag () == 0) { return level (file, base, n) ; }
+
+  Key key { file, n, spec.tag () } ;
+  auto image = find (key) ;
+  if (image.isNull ()) {
+    // may come out smaller than level n, the view scales it up
+    auto source = Filters::source_level (spec, base.size (), n) ;
+    image = Filters::apply (level (file, base, source), spec, source) ;
+    QMutexLocker lock (&mutex) ;
+    store (key, image) ;
+  }
+  return image ;
+}
+
+QImage ImageCache::edges (const QString & file, const QImage & base, int n, int threshold) {
+  // the magnitude is kept, any threshold is a cheap pass over it
+  Key key { file, n, Filters::edge_tag } ;
+  auto magnitude = find (key) ;
+  if (magnitude.isNull ()) {
+    magnitude = Kernels::edges (level (file, base, n), 0) ;
+    QMutexLocker lock (&mutex) ;
+    store (key, magnitude) ;
+  }
+  return Filters::edges (magnitude, threshold) ;
+}
+
+QImage ImageCache::peek (const QString & file, int n, const Filters::Spec & spec) {
+  return find (Key { file, n, spec.tag () }) ;
+}
+
+double ImageCache::fit_scale (const QSize & size, const QSizeF & box) {
+  if (size.isEmpty ()) { return 1 ; }
+  return qMin (box.width () / size.width (), box.height () / size.height ()) ;
+}
+
+int ImageCache::level_for (const QSize & size, double scale) {
+  // levels below this are not worth a separate upload
+  const int min_side = 64 ;
+  int n = 0 ;
+  while (scale <= 0.5 && qMin (size.width (), size.height ()) >> (n + 1) >= min_side) {
+    scale *= 2 ;
+    n++ ;
+  }
+  return n ;
+}
+
+void ImageCache::clear () {
+  {
+    QMutexLocker lock (&mutex) ;
+    entries.clear () ;
+    used = 0 ;
+  }
+  app->mem.set (MemStats::cache, 0) ;
+  decoded.wakeAll () ;
+}
+
+qint64 ImageCache::bytes () const {
+  QMutexLocker lock (&mutex) ;
+  return used ;
+}
+
+void ImageCache::store (const Key & key, const QImage & image) {
+  auto & entry = entries[key] ;
+  if (entry.ready) { used -= MemStats::bytes_of (entry.image) ; }
+
+  entry.image = image ;
+  entry.ready = true ;
+  entry.stamp = ++clock ;
+  used += MemStats::bytes_of (image) ;
+
+  trim (key) ;
+  app->mem.set (MemStats::cache, used) ;
+}
+
+void ImageCache::trim (const Key & keep) {
+  while (used > budget) {
+    auto oldest = entries.end () ;
+    for (auto iter = entries.begin () ; iter != entries.end () ; iter++) {
+      if (! iter->ready || iter.key () == keep) { continue ; }
+      if (oldest == entries.end () || iter->stamp < oldest->stamp) { oldest = iter ; }
+    }
+    if (oldest == entries.end ()) { return ; }
+
+    used -= MemStats::bytes_of (oldest->image) ;
+    entries.erase (oldest) ;
+  }
+}
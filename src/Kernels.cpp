@@ -0,0 +1,861 @@
+#include "Kernels.hpp"
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QScopedPointer>
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define IMVIEW_X86 1
+#include <immintrin.h>
+#define TARGET(isa) __attribute__ ((target (isa)))
+#endif
+
+namespace {
+
+// Rec. 709 weights in 8 bit fixed point, they add up to 256
+const int luma_r = 54 ;
+const int luma_g = 183 ;
+const int luma_b = 19 ;
+
+inline uchar luma_of (quint32 px) {
+  quint32 r = (px >> 16) & 0xff ;
+  quint32 g = (px >> 8) & 0xff ;
+  quint32 b = px & 0xff ;
+  return static_cast<uchar> ((r * luma_r + g * luma_g + b * luma_b + 128) >> 8) ;
+}
+
+void luma_row_scalar (const quint32 * in, uchar * out, int n) {
+  for (int i = 0 ; i < n ; i++) { out[i] = luma_of (in[i]) ; }
+}
+
+// band k covers values from threshold[k] up, each band adds step[k] on top
+// of the previous one, so a value ends up at round (255 * band / (levels - 1))
+struct Bands {
+  int count ;
+  uchar threshold [8] ;
+  uchar step [8] ;
+  uchar lut [256] ;
+
+  explicit Bands (int levels) : count (levels - 1) {
+    int previous = 0 ;
+    for (int k = 1 ; k < levels ; k++) {
+      threshold [k - 1] = static_cast<uchar> ((256 * k + levels - 1) / levels) ;
+      int value = (255 * k + (levels - 1) / 2) / (levels - 1) ;
+      step [k - 1] = static_cast<uchar> (value - previous) ;
+      previous = value ;
+    }
+    for (int v = 0 ; v < 256 ; v++) {
+      int value = 0 ;
+      for (int k = 0 ; k < count ; k++) {
+        if (v >= threshold [k]) { value += step [k] ; }
+      }
+      lut [v] = static_cast<uchar> (value) ;
+    }
+  }
+} ;
+
+void posterize_row_scalar (const uchar * in, uchar * out, int n, const Bands & bands) {
+  for (int i = 0 ; i < n ; i++) { out[i] = bands.lut [in[i]] ; }
+}
+
+inline quint32 avg_px (quint32 a, quint32 b) {
+  // per byte (a + b + 1) >> 1, which is what pavgb does
+  return (a | b) - (((a ^ b) >> 1) & 0x7f7f7f7fU) ;
+}
+
+void halve_row_scalar (const quint32 * r0, const quint32 * r1, quint32 * out, int n) {
+  for (int i = 0 ; i < n ; i++) {
+    out[i] = avg_px (avg_px (r0[2 * i], r1[2 * i]), avg_px (r0[2 * i + 1], r1[2 * i + 1])) ;
+  }
+}
+
+// One vertical box pass over the bytes [begin, end) of every row, edges
+// extended. The window sums of a byte column fit 16 bits up to max_blur,
+// and dividing is a multiply by a 16 bit reciprocal, as pmulhuw does.
+struct BoxPass {
+  const uchar * src ;
+  uchar * dst ;
+  int stride ;
+  int height ;
+  int radius ;
+  quint16 * sums ;
+
+  const uchar * row (int y) const {
+    return src + qptrdiff (qBound (0, y, height - 1)) * stride ;
+  }
+  uchar * out (int y) const { return dst + qptrdiff (y) * stride ; }
+  quint32 half () const { return radius ; }
+  quint32 reciprocal () const { return (65536 + 2 * radius) / (2 * radius + 1) ; }
+
+  void init (int begin, int end) const {
+    for (int b = begin ; b < end ; b++) {
+      quint32 sum = (radius + 1) * row (0)[b] ;
+      for (int i = 1 ; i <= radius ; i++) { sum += row (i)[b] ; }
+      sums[b - begin] = static_cast<quint16> (sum) ;
+    }
+  }
+
+  // writes row y and slides the window down, for bytes [from, to)
+  void step (int y, int begin, int from, int to) const {
+    auto in = row (y + radius + 1) ;
+    auto gone = row (y - radius) ;
+    auto dst = out (y) ;
+    auto inv = reciprocal () ;
+    for (int b = from ; b < to ; b++) {
+      quint32 sum = sums[b - begin] ;
+      dst[b] = static_cast<uchar> (((sum + half ()) * inv) >> 16) ;
+      sums[b - begin] = static_cast<quint16> (sum + in[b] - gone[b]) ;
+    }
+  }
+} ;
+
+void box_pass_scalar (const BoxPass & p, int begin, int end) {
+  p.init (begin, end) ;
+  for (int y = 0 ; y < p.height ; y++) { p.step (y, begin, begin, end) ; }
+}
+
+// four interleaved sets of counters, so neighbouring pixels with the
+// same value do not wait on each other's increments
+struct Tally {
+  quint32 lanes [4][4][256] ;
+
+  Tally () { memset (lanes, 0, sizeof (lanes)) ; }
+
+  void row (const quint32 * in, const uchar * luma, int n) {
+    int i = 0 ;
+    for ( ; i + 4 <= n ; i += 4) {
+      for (int k = 0 ; k < 4 ; k++) {
+        auto px = in[i + k] ;
+        auto & lane = lanes[k] ;
+        lane[0][luma[i + k]]++ ;
+        lane[1][(px >> 16) & 0xff]++ ;
+        lane[2][(px >> 8) & 0xff]++ ;
+        lane[3][px & 0xff]++ ;
+      }
+    }
+    for ( ; i < n ; i++) {
+      lanes[0][0][luma[i]]++ ;
+      lanes[0][1][(in[i] >> 16) & 0xff]++ ;
+      lanes[0][2][(in[i] >> 8) & 0xff]++ ;
+      lanes[0][3][in[i] & 0xff]++ ;
+    }
+  }
+} ;
+
+// Scharr gradients, |gx| + |gy| over 16 : a step of 255 comes out at 255.
+// Rows above and below are p and n, columns outside the row are clamped.
+inline uchar edge_at (const uchar * p, const uchar * c, const uchar * n, int l, int x, int r) {
+  int gx = 3 * (p[r] - p[l] + n[r] - n[l]) + 10 * (c[r] - c[l]) ;
+  int gy = 3 * (n[l] - p[l] + n[r] - p[r]) + 10 * (n[x] - p[x]) ;
+  return static_cast<uchar> (qMin (255, (qAbs (gx) + qAbs (gy)) >> 4)) ;
+}
+
+void edge_span_scalar (const uchar * p, const uchar * c, const uchar * n, uchar * out,
+  int width, int from, int to, uchar threshold)
+{
+  for (int x = from ; x < to ; x++) {
+    auto m = edge_at (p, c, n, qMax (x - 1, 0), x, qMin (x + 1, width - 1)) ;
+    out[x] = m >= threshold ? m : 0 ;
+  }
+}
+
+void edge_row_scalar (const uchar * p, const uchar * c, const uchar * n, uchar * out,
+  int width, uchar threshold)
+{
+  edge_span_scalar (p, c, n, out, width, 0, width, threshold) ;
+}
+
+// per channel |a - b|, opaque whatever the inputs' alpha
+void difference_row_scalar (const quint32 * a, const quint32 * b, quint32 * out, int n) {
+  for (int i = 0 ; i < n ; i++) {
+    quint32 d = 0xff000000U ;
+    for (int shift = 0 ; shift < 24 ; shift += 8) {
+      int x = int ((a[i] >> shift) & 0xff) - int ((b[i] >> shift) & 0xff) ;
+      d |= quint32 (qAbs (x)) << shift ;
+    }
+    out[i] = d ;
+  }
+}
+
+// src rows [y0, y1) become dst columns
+void transpose_scalar (const uchar * src, int src_stride, uchar * dst, int dst_stride,
+  int width, int y0, int y1)
+{
+  for (int y = y0 ; y < y1 ; y++) {
+    auto in = reinterpret_cast<const quint32 *> (src + qptrdiff (y) * src_stride) ;
+    for (int x = 0 ; x < width ; x++) {
+      reinterpret_cast<quint32 *> (dst + qptrdiff (x) * dst_stride)[y] = in[x] ;
+    }
+  }
+}
+
+#ifdef IMVIEW_X86
+
+TARGET ("sse2") inline __m128i luma16_sse2 (const quint32 * in) {
+  const __m128i mask = _mm_set1_epi32 (0xff) ;
+  const __m128i wr = _mm_set1_epi16 (luma_r) ;
+  const __m128i wg = _mm_set1_epi16 (luma_g) ;
+  const __m128i wb = _mm_set1_epi16 (luma_b) ;
+  const __m128i half = _mm_set1_epi16 (128) ;
+
+  __m128i y[2] ;
+  for (int h = 0 ; h < 2 ; h++) {
+    auto v0 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (in + 8 * h)) ;
+    auto v1 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (in + 8 * h + 4)) ;
+    auto b = _mm_packs_epi32 (_mm_and_si128 (v0, mask), _mm_and_si128 (v1, mask)) ;
+    auto g = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (v0, 8), mask),
+                              _mm_and_si128 (_mm_srli_epi32 (v1, 8), mask)) ;
+    auto r = _mm_packs_epi32 (_mm_and_si128 (_mm_srli_epi32 (v0, 16), mask),
+                              _mm_and_si128 (_mm_srli_epi32 (v1, 16), mask)) ;
+    // at most 255 * 256 + 128, wraps nowhere as unsigned 16 bit
+    auto sum = _mm_add_epi16 (_mm_add_epi16 (_mm_mullo_epi16 (r, wr), _mm_mullo_epi16 (g, wg)),
+                              _mm_add_epi16 (_mm_mullo_epi16 (b, wb), half)) ;
+    y[h] = _mm_srli_epi16 (sum, 8) ;
+  }
+  return _mm_packus_epi16 (y[0], y[1]) ;
+}
+
+TARGET ("sse2") void luma_row_sse2 (const quint32 * in, uchar * out, int n) {
+  int i = 0 ;
+  for ( ; i + 16 <= n ; i += 16) {
+    _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + i), luma16_sse2 (in + i)) ;
+  }
+  luma_row_scalar (in + i, out + i, n - i) ;
+}
+
+TARGET ("avx2") void luma_row_avx2 (const quint32 * in, uchar * out, int n) {
+  const __m256i mask = _mm256_set1_epi32 (0xff) ;
+  const __m256i wr = _mm256_set1_epi16 (luma_r) ;
+  const __m256i wg = _mm256_set1_epi16 (luma_g) ;
+  const __m256i wb = _mm256_set1_epi16 (luma_b) ;
+  const __m256i half = _mm256_set1_epi16 (128) ;
+  // packs work within 128 bit lanes, this puts groups of 4 back in order
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7) ;
+
+  int i = 0 ;
+  for ( ; i + 32 <= n ; i += 32) {
+    __m256i y[2] ;
+    for (int h = 0 ; h < 2 ; h++) {
+      auto v0 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (in + i + 16 * h)) ;
+      auto v1 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (in + i + 16 * h + 8)) ;
+      auto b = _mm256_packs_epi32 (_mm256_and_si256 (v0, mask), _mm256_and_si256 (v1, mask)) ;
+      auto g = _mm256_packs_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (v0, 8), mask),
+                                   _mm256_and_si256 (_mm256_srli_epi32 (v1, 8), mask)) ;
+      auto r = _mm256_packs_epi32 (_mm256_and_si256 (_mm256_srli_epi32 (v0, 16), mask),
+                                   _mm256_and_si256 (_mm256_srli_epi32 (v1, 16), mask)) ;
+      auto sum = _mm256_add_epi16 (
+        _mm256_add_epi16 (_mm256_mullo_epi16 (r, wr), _mm256_mullo_epi16 (g, wg)),
+        _mm256_add_epi16 (_mm256_mullo_epi16 (b, wb), half)) ;
+      y[h] = _mm256_srli_epi16 (sum, 8) ;
+    }
+    auto packed = _mm256_permutevar8x32_epi32 (_mm256_packus_epi16 (y[0], y[1]), order) ;
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (out + i), packed) ;
+  }
+  luma_row_scalar (in + i, out + i, n - i) ;
+}
+
+TARGET ("sse2") void posterize_row_sse2 (const uchar * in, uchar * out, int n, const Bands & bands) {
+  __m128i threshold [8], step [8] ;
+  for (int k = 0 ; k < bands.count ; k++) {
+    threshold [k] = _mm_set1_epi8 (static_cast<char> (bands.threshold [k])) ;
+    step [k] = _mm_set1_epi8 (static_cast<char> (bands.step [k])) ;
+  }
+
+  int i = 0 ;
+  for ( ; i + 16 <= n ; i += 16) {
+    auto v = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (in + i)) ;
+    auto value = _mm_setzero_si128 () ;
+    for (int k = 0 ; k < bands.count ; k++) {
+      // unsigned v >= threshold
+      auto ge = _mm_cmpeq_epi8 (_mm_max_epu8 (v, threshold [k]), v) ;
+      value = _mm_add_epi8 (value, _mm_and_si128 (ge, step [k])) ;
+    }
+    _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + i), value) ;
+  }
+  posterize_row_scalar (in + i, out + i, n - i, bands) ;
+}
+
+TARGET ("avx2") void posterize_row_avx2 (const uchar * in, uchar * out, int n, const Bands & bands) {
+  __m256i threshold [8], step [8] ;
+  for (int k = 0 ; k < bands.count ; k++) {
+    threshold [k] = _mm256_set1_epi8 (static_cast<char> (bands.threshold [k])) ;
+    step [k] = _mm256_set1_epi8 (static_cast<char> (bands.step [k])) ;
+  }
+
+  int i = 0 ;
+  for ( ; i + 32 <= n ; i += 32) {
+    auto v = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (in + i)) ;
+    auto value = _mm256_setzero_si256 () ;
+    for (int k = 0 ; k < bands.count ; k++) {
+      auto ge = _mm256_cmpeq_epi8 (_mm256_max_epu8 (v, threshold [k]), v) ;
+      value = _mm256_add_epi8 (value, _mm256_and_si256 (ge, step [k])) ;
+    }
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (out + i), value) ;
+  }
+  posterize_row_scalar (in + i, out + i, n - i, bands) ;
+}
+
+TARGET ("sse2") void halve_row_sse2 (const quint32 * r0, const quint32 * r1, quint32 * out, int n) {
+  int i = 0 ;
+  for ( ; i + 4 <= n ; i += 4) {
+    auto a0 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (r0 + 2 * i)) ;
+    auto a1 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (r0 + 2 * i + 4)) ;
+    auto b0 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (r1 + 2 * i)) ;
+    auto b1 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (r1 + 2 * i + 4)) ;
+    auto v0 = _mm_castsi128_ps (_mm_avg_epu8 (a0, b0)) ;
+    auto v1 = _mm_castsi128_ps (_mm_avg_epu8 (a1, b1)) ;
+    auto even = _mm_castps_si128 (_mm_shuffle_ps (v0, v1, _MM_SHUFFLE (2, 0, 2, 0))) ;
+    auto odd = _mm_castps_si128 (_mm_shuffle_ps (v0, v1, _MM_SHUFFLE (3, 1, 3, 1))) ;
+    _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + i), _mm_avg_epu8 (even, odd)) ;
+  }
+  halve_row_scalar (r0 + 2 * i, r1 + 2 * i, out + i, n - i) ;
+}
+
+TARGET ("avx2") void halve_row_avx2 (const quint32 * r0, const quint32 * r1, quint32 * out, int n) {
+  int i = 0 ;
+  for ( ; i + 8 <= n ; i += 8) {
+    auto a0 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (r0 + 2 * i)) ;
+    auto a1 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (r0 + 2 * i + 8)) ;
+    auto b0 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (r1 + 2 * i)) ;
+    auto b1 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (r1 + 2 * i + 8)) ;
+    auto v0 = _mm256_castsi256_ps (_mm256_avg_epu8 (a0, b0)) ;
+    auto v1 = _mm256_castsi256_ps (_mm256_avg_epu8 (a1, b1)) ;
+    auto even = _mm256_castps_si256 (_mm256_shuffle_ps (v0, v1, _MM_SHUFFLE (2, 0, 2, 0))) ;
+    auto odd = _mm256_castps_si256 (_mm256_shuffle_ps (v0, v1, _MM_SHUFFLE (3, 1, 3, 1))) ;
+    // shuffles stay within 128 bit lanes, swap the middle pairs back
+    auto result = _mm256_permute4x64_epi64 (_mm256_avg_epu8 (even, odd), _MM_SHUFFLE (3, 1, 2, 0)) ;
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (out + i), result) ;
+  }
+  halve_row_scalar (r0 + 2 * i, r1 + 2 * i, out + i, n - i) ;
+}
+
+TARGET ("sse2") void box_pass_sse2 (const BoxPass & p, int begin, int end) {
+  p.init (begin, end) ;
+  const __m128i zero = _mm_setzero_si128 () ;
+  const __m128i half = _mm_set1_epi16 (static_cast<short> (p.half ())) ;
+  const __m128i inv = _mm_set1_epi16 (static_cast<short> (p.reciprocal ())) ;
+  int n = end - begin ;
+
+  for (int y = 0 ; y < p.height ; y++) {
+    auto in = p.row (y + p.radius + 1) + begin ;
+    auto gone = p.row (y - p.radius) + begin ;
+    auto dst = p.out (y) + begin ;
+    int i = 0 ;
+    for ( ; i + 16 <= n ; i += 16) {
+      auto s0 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (p.sums + i)) ;
+      auto s1 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (p.sums + i + 8)) ;
+      auto q0 = _mm_mulhi_epu16 (_mm_add_epi16 (s0, half), inv) ;
+      auto q1 = _mm_mulhi_epu16 (_mm_add_epi16 (s1, half), inv) ;
+      _mm_storeu_si128 (reinterpret_cast<__m128i *> (dst + i), _mm_packus_epi16 (q0, q1)) ;
+
+      auto a = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (in + i)) ;
+      auto b = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (gone + i)) ;
+      s0 = _mm_sub_epi16 (_mm_add_epi16 (s0, _mm_unpacklo_epi8 (a, zero)), _mm_unpacklo_epi8 (b, zero)) ;
+      s1 = _mm_sub_epi16 (_mm_add_epi16 (s1, _mm_unpackhi_epi8 (a, zero)), _mm_unpackhi_epi8 (b, zero)) ;
+      _mm_storeu_si128 (reinterpret_cast<__m128i *> (p.sums + i), s0) ;
+      _mm_storeu_si128 (reinterpret_cast<__m128i *> (p.sums + i + 8), s1) ;
+    }
+    p.step (y, begin, begin + i, end) ;
+  }
+}
+
+TARGET ("avx2") void box_pass_avx2 (const BoxPass & p, int begin, int end) {
+  p.init (begin, end) ;
+  const __m256i half = _mm256_set1_epi16 (static_cast<short> (p.half ())) ;
+  const __m256i inv = _mm256_set1_epi16 (static_cast<short> (p.reciprocal ())) ;
+  int n = end - begin ;
+
+  for (int y = 0 ; y < p.height ; y++) {
+    auto in = p.row (y + p.radius + 1) + begin ;
+    auto gone = p.row (y - p.radius) + begin ;
+    auto dst = p.out (y) + begin ;
+    int i = 0 ;
+    for ( ; i + 32 <= n ; i += 32) {
+      auto s0 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (p.sums + i)) ;
+      auto s1 = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (p.sums + i + 16)) ;
+      auto q0 = _mm256_mulhi_epu16 (_mm256_add_epi16 (s0, half), inv) ;
+      auto q1 = _mm256_mulhi_epu16 (_mm256_add_epi16 (s1, half), inv) ;
+      // packing interleaves the 128 bit lanes, put them back in order
+      auto q = _mm256_permute4x64_epi64 (_mm256_packus_epi16 (q0, q1), _MM_SHUFFLE (3, 1, 2, 0)) ;
+      _mm256_storeu_si256 (reinterpret_cast<__m256i *> (dst + i), q) ;
+
+      auto a = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (in + i)) ;
+      auto b = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (gone + i)) ;
+      s0 = _mm256_sub_epi16 (
+        _mm256_add_epi16 (s0, _mm256_cvtepu8_epi16 (_mm256_castsi256_si128 (a))),
+        _mm256_cvtepu8_epi16 (_mm256_castsi256_si128 (b))) ;
+      s1 = _mm256_sub_epi16 (
+        _mm256_add_epi16 (s1, _mm256_cvtepu8_epi16 (_mm256_extracti128_si256 (a, 1))),
+        _mm256_cvtepu8_epi16 (_mm256_extracti128_si256 (b, 1))) ;
+      _mm256_storeu_si256 (reinterpret_cast<__m256i *> (p.sums + i), s0) ;
+      _mm256_storeu_si256 (reinterpret_cast<__m256i *> (p.sums + i + 16), s1) ;
+    }
+    p.step (y, begin, begin + i, end) ;
+  }
+}
+
+// magnitudes of the 8 pixels from x, 16 bit ; all sums stay within 8160
+TARGET ("sse2") inline __m128i edge8_sse2 (const uchar * p, const uchar * c, const uchar * n, int x) {
+  const __m128i zero = _mm_setzero_si128 () ;
+  const __m128i three = _mm_set1_epi16 (3) ;
+  const __m128i ten = _mm_set1_epi16 (10) ;
+  auto pl = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (p + x - 1)), zero) ;
+  auto px = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (p + x)), zero) ;
+  auto pr = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (p + x + 1)), zero) ;
+  auto cl = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (c + x - 1)), zero) ;
+  auto cr = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (c + x + 1)), zero) ;
+  auto nl = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (n + x - 1)), zero) ;
+  auto nx = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (n + x)), zero) ;
+  auto nr = _mm_unpacklo_epi8 (_mm_loadl_epi64 (reinterpret_cast<const __m128i *> (n + x + 1)), zero) ;
+
+  auto gx = _mm_add_epi16 (
+    _mm_mullo_epi16 (_mm_sub_epi16 (_mm_add_epi16 (pr, nr), _mm_add_epi16 (pl, nl)), three),
+    _mm_mullo_epi16 (_mm_sub_epi16 (cr, cl), ten)) ;
+  auto gy = _mm_add_epi16 (
+    _mm_mullo_epi16 (_mm_sub_epi16 (_mm_add_epi16 (nl, nr), _mm_add_epi16 (pl, pr)), three),
+    _mm_mullo_epi16 (_mm_sub_epi16 (nx, px), ten)) ;
+  auto ax = _mm_max_epi16 (gx, _mm_sub_epi16 (zero, gx)) ;
+  auto ay = _mm_max_epi16 (gy, _mm_sub_epi16 (zero, gy)) ;
+  return _mm_srli_epi16 (_mm_add_epi16 (ax, ay), 4) ;
+}
+
+TARGET ("sse2") void edge_row_sse2 (const uchar * p, const uchar * c, const uchar * n, uchar * out,
+  int width, uchar threshold)
+{
+  const __m128i t = _mm_set1_epi8 (static_cast<char> (threshold)) ;
+  edge_span_scalar (p, c, n, out, width, 0, qMin (1, width), threshold) ;
+  // loads reach one past the last pixel written, which stays inside the row
+  int x = 1 ;
+  for ( ; x + 16 <= width - 1 ; x += 16) {
+    auto m = _mm_packus_epi16 (edge8_sse2 (p, c, n, x), edge8_sse2 (p, c, n, x + 8)) ;
+    auto keep = _mm_cmpeq_epi8 (_mm_max_epu8 (m, t), m) ;
+    _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + x), _mm_and_si128 (m, keep)) ;
+  }
+  edge_span_scalar (p, c, n, out, width, qMin (x, width), width, threshold) ;
+}
+
+TARGET ("avx2") inline __m256i edge16_avx2 (const uchar * p, const uchar * c, const uchar * n, int x) {
+  const __m256i three = _mm256_set1_epi16 (3) ;
+  const __m256i ten = _mm256_set1_epi16 (10) ;
+  auto pl = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (p + x - 1))) ;
+  auto px = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (p + x))) ;
+  auto pr = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (p + x + 1))) ;
+  auto cl = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (c + x - 1))) ;
+  auto cr = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (c + x + 1))) ;
+  auto nl = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (n + x - 1))) ;
+  auto nx = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (n + x))) ;
+  auto nr = _mm256_cvtepu8_epi16 (_mm_loadu_si128 (reinterpret_cast<const __m128i *> (n + x + 1))) ;
+
+  auto gx = _mm256_add_epi16 (
+    _mm256_mullo_epi16 (_mm256_sub_epi16 (_mm256_add_epi16 (pr, nr), _mm256_add_epi16 (pl, nl)), three),
+    _mm256_mullo_epi16 (_mm256_sub_epi16 (cr, cl), ten)) ;
+  auto gy = _mm256_add_epi16 (
+    _mm256_mullo_epi16 (_mm256_sub_epi16 (_mm256_add_epi16 (nl, nr), _mm256_add_epi16 (pl, pr)), three),
+    _mm256_mullo_epi16 (_mm256_sub_epi16 (nx, px), ten)) ;
+  return _mm256_srli_epi16 (_mm256_add_epi16 (_mm256_abs_epi16 (gx), _mm256_abs_epi16 (gy)), 4) ;
+}
+
+TARGET ("avx2") void edge_row_avx2 (const uchar * p, const uchar * c, const uchar * n, uchar * out,
+  int width, uchar threshold)
+{
+  const __m256i t = _mm256_set1_epi8 (static_cast<char> (threshold)) ;
+  edge_span_scalar (p, c, n, out, width, 0, qMin (1, width), threshold) ;
+  int x = 1 ;
+  for ( ; x + 32 <= width - 1 ; x += 32) {
+    auto m = _mm256_permute4x64_epi64 (
+      _mm256_packus_epi16 (edge16_avx2 (p, c, n, x), edge16_avx2 (p, c, n, x + 16)),
+      _MM_SHUFFLE (3, 1, 2, 0)) ;
+    auto keep = _mm256_cmpeq_epi8 (_mm256_max_epu8 (m, t), m) ;
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (out + x), _mm256_and_si256 (m, keep)) ;
+  }
+  edge_span_scalar (p, c, n, out, width, qMin (x, width), width, threshold) ;
+}
+
+// saturating subtractions both ways, one of them is 0
+TARGET ("sse2") void difference_row_sse2 (const quint32 * a, const quint32 * b, quint32 * out, int n) {
+  const __m128i alpha = _mm_set1_epi32 (static_cast<int> (0xff000000U)) ;
+  int i = 0 ;
+  for ( ; i + 4 <= n ; i += 4) {
+    auto va = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (a + i)) ;
+    auto vb = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (b + i)) ;
+    auto d = _mm_or_si128 (_mm_subs_epu8 (va, vb), _mm_subs_epu8 (vb, va)) ;
+    _mm_storeu_si128 (reinterpret_cast<__m128i *> (out + i), _mm_or_si128 (d, alpha)) ;
+  }
+  difference_row_scalar (a + i, b + i, out + i, n - i) ;
+}
+
+TARGET ("avx2") void difference_row_avx2 (const quint32 * a, const quint32 * b, quint32 * out, int n) {
+  const __m256i alpha = _mm256_set1_epi32 (static_cast<int> (0xff000000U)) ;
+  int i = 0 ;
+  for ( ; i + 8 <= n ; i += 8) {
+    auto va = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (a + i)) ;
+    auto vb = _mm256_loadu_si256 (reinterpret_cast<const __m256i *> (b + i)) ;
+    auto d = _mm256_or_si256 (_mm256_subs_epu8 (va, vb), _mm256_subs_epu8 (vb, va)) ;
+    _mm256_storeu_si256 (reinterpret_cast<__m256i *> (out + i), _mm256_or_si256 (d, alpha)) ;
+  }
+  difference_row_scalar (a + i, b + i, out + i, n - i) ;
+}
+
+// 4x4 blocks through registers, the ragged edges go the scalar way
+TARGET ("sse2") void transpose_sse2 (const uchar * src, int src_stride, uchar * dst, int dst_stride,
+  int width, int y0, int y1)
+{
+  int y = y0 ;
+  for ( ; y + 4 <= y1 ; y += 4) {
+    const float * in [4] ;
+    for (int k = 0 ; k < 4 ; k++) {
+      in[k] = reinterpret_cast<const float *> (src + qptrdiff (y + k) * src_stride) ;
+    }
+    int x = 0 ;
+    for ( ; x + 4 <= width ; x += 4) {
+      auto r0 = _mm_loadu_ps (in[0] + x) ;
+      auto r1 = _mm_loadu_ps (in[1] + x) ;
+      auto r2 = _mm_loadu_ps (in[2] + x) ;
+      auto r3 = _mm_loadu_ps (in[3] + x) ;
+      _MM_TRANSPOSE4_PS (r0, r1, r2, r3) ;
+      _mm_storeu_ps (reinterpret_cast<float *> (dst + qptrdiff (x) * dst_stride) + y, r0) ;
+      _mm_storeu_ps (reinterpret_cast<float *> (dst + qptrdiff (x + 1) * dst_stride) + y, r1) ;
+      _mm_storeu_ps (reinterpret_cast<float *> (dst + qptrdiff (x + 2) * dst_stride) + y, r2) ;
+      _mm_storeu_ps (reinterpret_cast<float *> (dst + qptrdiff (x + 3) * dst_stride) + y, r3) ;
+    }
+    for ( ; x < width ; x++) {
+      for (int k = 0 ; k < 4 ; k++) {
+        reinterpret_cast<quint32 *> (dst + qptrdiff (x) * dst_stride)[y + k] =
+          reinterpret_cast<const quint32 *> (in[k])[x] ;
+      }
+    }
+  }
+  transpose_scalar (src, src_stride, dst, dst_stride, width, y, y1) ;
+}
+
+#endif
+
+Kernels::Isa detect_isa () {
+  auto isa = Kernels::Isa::scalar ;
+#ifdef IMVIEW_X86
+  __builtin_cpu_init () ;
+  if (__builtin_cpu_supports ("sse2")) { isa = Kernels::Isa::sse2 ; }
+  if (__builtin_cpu_supports ("avx2")) { isa = Kernels::Isa::avx2 ; }
+#endif
+
+  auto cap = getenv ("IMVIEW_ISA") ;
+  if (cap && strcmp (cap, "scalar") == 0) { isa = Kernels::Isa::scalar ; }
+  else if (cap && strcmp (cap, "sse2") == 0 && isa == Kernels::Isa::avx2) {
+    isa = Kernels::Isa::sse2 ;
+  }
+  return isa ;
+}
+
+class BandJob : public QRunnable {
+  public :
+
+  BandJob (const std::function<void(int,int)> & band, int begin, int end, QSemaphore * done)
+    : band (band), begin (begin), end (end), done (done) { }
+
+  virtual void run () {
+    band (begin, end) ;
+    done->release () ;
+  }
+
+  const std::function<void(int,int)> & band ;
+  int begin, end ;
+  QSemaphore * done ;
+} ;
+
+QThreadPool & band_pool () {
+  // apart from the global pool, so bands never queue behind other work
+  static QThreadPool pool ;
+  return pool ;
+}
+
+}
+
+Kernels::Isa Kernels::isa () {
+  static const Isa detected = detect_isa () ;
+  return detected ;
+}
+
+const char * Kernels::isa_name (Isa isa) {
+  switch (isa) {
+    case Isa::avx2 : return "avx2" ;
+    case Isa::sse2 : return "sse2" ;
+    default : return "scalar" ;
+  }
+}
+
+void Kernels::for_rows (int rows, const std::function<void(int,int)> & band, int grain) {
+  // bands below grain rows cost more to hand over than to run
+  int bands = qBound (1, rows / qMax (1, grain), band_pool ().maxThreadCount () + 1) ;
+  if (bands == 1) {
+    band (0, rows) ;
+    return ;
+  }
+
+  QSemaphore done ;
+  for (int k = 1 ; k < bands ; k++) {
+    band_pool ().start (new BandJob (band, rows * k / bands, rows * (k + 1) / bands, &done)) ;
+  }
+  band (0, rows / bands) ;
+  done.acquire (bands - 1) ;
+}
+
+QImage Kernels::to_32bit (const QImage & image) {
+  switch (image.format ()) {
+    case QImage::Format_RGB32 :
+    case QImage::Format_ARGB32 :
+    case QImage::Format_ARGB32_Premultiplied :
+      return image ;
+    default :
+      // premultiplied, so translucent pixels read as they show on black
+      return image.convertToFormat (image.hasAlphaChannel ()
+        ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32) ;
+  }
+}
+
+QImage Kernels::luminance (const QImage & image) {
+  if (image.isNull ()) { return QImage () ; }
+
+  auto in = to_32bit (image) ;
+  QImage out (in.size (), QImage::Format_Grayscale8) ;
+  auto row = luma_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { row = luma_row_avx2 ; }
+  else if (isa () == Isa::sse2) { row = luma_row_sse2 ; }
+#endif
+
+  // scanLine () would detach from the bands at once
+  auto dst = out.bits () ;
+  int stride = out.bytesPerLine (), width = in.width () ;
+  for_rows (in.height (), [&] (int begin, int end) {
+    for (int y = begin ; y < end ; y++) {
+      row (reinterpret_cast<const quint32 *> (in.constScanLine (y)), dst + y * stride, width) ;
+    }
+  }) ;
+  return out ;
+}
+
+QImage Kernels::posterize (const QImage & gray, int levels) {
+  if (gray.isNull ()) { return QImage () ; }
+
+  auto in = gray.format () == QImage::Format_Grayscale8 ? gray : luminance (gray) ;
+  QImage out (in.size (), QImage::Format_Grayscale8) ;
+  Bands bands (qBound (2, levels, 8)) ;
+  auto row = posterize_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { row = posterize_row_avx2 ; }
+  else if (isa () == Isa::sse2) { row = posterize_row_sse2 ; }
+#endif
+
+  auto dst = out.bits () ;
+  int stride = out.bytesPerLine (), width = in.width () ;
+  for_rows (in.height (), [&] (int begin, int end) {
+    for (int y = begin ; y < end ; y++) {
+      row (in.constScanLine (y), dst + y * stride, width, bands) ;
+    }
+  }) ;
+  return out ;
+}
+
+Kernels::Histograms Kernels::histograms (const QImage & image) {
+  Histograms result ;
+  memset (&result, 0, sizeof (result)) ;
+  if (image.isNull ()) { return result ; }
+
+  auto in = to_32bit (image) ;
+  auto luma_row = luma_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { luma_row = luma_row_avx2 ; }
+  else if (isa () == Isa::sse2) { luma_row = luma_row_sse2 ; }
+#endif
+
+  QMutex merge ;
+  int width = in.width () ;
+  for_rows (in.height (), [&] (int begin, int end) {
+    // luma a row at a time through the wide kernels, then counted
+    QVector<uchar> luma (width) ;
+    QScopedPointer<Tally> tally (new Tally) ;
+    for (int y = begin ; y < end ; y++) {
+      auto row = reinterpret_cast<const quint32 *> (in.constScanLine (y)) ;
+      luma_row (row, luma.data (), width) ;
+      tally->row (row, luma.constData (), width) ;
+    }
+
+    QMutexLocker lock (&merge) ;
+    quint32 * channels [4] = { result.luma, result.red, result.green, result.blue } ;
+    for (int k = 0 ; k < 4 ; k++) {
+      for (int c = 0 ; c < 4 ; c++) {
+        for (int v = 0 ; v < 256 ; v++) { channels[c][v] += tally->lanes[k][c][v] ; }
+      }
+    }
+  }) ;
+
+  result.pixels = quint64 (in.width ()) * in.height () ;
+  return result ;
+}
+
+QImage Kernels::edges (const QImage & image, int threshold) {
+  if (image.isNull ()) { return QImage () ; }
+
+  bool gray = image.format () == QImage::Format_Grayscale8 ;
+  auto in = gray ? image : to_32bit (image) ;
+  QImage out (in.size (), QImage::Format_Grayscale8) ;
+  auto luma_row = luma_row_scalar ;
+  auto edge_row = edge_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { luma_row = luma_row_avx2 ; edge_row = edge_row_avx2 ; }
+  else if (isa () == Isa::sse2) { luma_row = luma_row_sse2 ; edge_row = edge_row_sse2 ; }
+#endif
+
+  auto dst = out.bits () ;
+  int stride = out.bytesPerLine () ;
+  int width = in.width (), height = in.height () ;
+  auto t = static_cast<uchar> (qBound (0, threshold, 255)) ;
+  for_rows (height, [&] (int begin, int end) {
+    // luma of the three rows in use, so colour images never need a full
+    // size gray copy ; every row is converted once per band
+    QVector<uchar> ring (gray ? 0 : 3 * width) ;
+    int held [3] = { -1, -1, -1 } ;
+    auto luma = [&] (int y) -> const uchar * {
+      y = qBound (0, y, height - 1) ;
+      if (gray) { return in.constScanLine (y) ; }
+      auto slot = ring.data () + (y % 3) * width ;
+      if (held [y % 3] != y) {
+        luma_row (reinterpret_cast<const quint32 *> (in.constScanLine (y)), slot, width) ;
+        held [y % 3] = y ;
+      }
+      return slot ;
+    } ;
+
+    for (int y = begin ; y < end ; y++) {
+      auto p = luma (y - 1) ;
+      auto c = luma (y) ;
+      auto n = luma (y + 1) ;
+      edge_row (p, c, n, dst + y * stride, width, t) ;
+    }
+  }) ;
+  return out ;
+}
+
+QImage Kernels::difference (const QImage & image, const QImage & other, const QPoint & offset) {
+  if (image.isNull ()) { return QImage () ; }
+
+  auto a = to_32bit (image) ;
+  auto b = other.isNull () ? other : to_32bit (other) ;
+  QImage out (a.size (), QImage::Format_ARGB32_Premultiplied) ;
+  auto row = difference_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { row = difference_row_avx2 ; }
+  else if (isa () == Isa::sse2) { row = difference_row_sse2 ; }
+#endif
+
+  // columns of image that other covers
+  int width = a.width () ;
+  int x0 = qBound (0, offset.x (), width) ;
+  int x1 = qBound (0, offset.x () + b.width (), width) ;
+  auto bits = out.bits () ;
+  int stride = out.bytesPerLine () ;
+  for_rows (a.height (), [&] (int begin, int end) {
+    for (int y = begin ; y < end ; y++) {
+      auto dst = reinterpret_cast<quint32 *> (bits + y * stride) ;
+      int by = y - offset.y () ;
+      if (by < 0 || by >= b.height () || x0 >= x1) {
+        memset (dst, 0, width * sizeof (quint32)) ;
+        continue ;
+      }
+      memset (dst, 0, x0 * sizeof (quint32)) ;
+      row (reinterpret_cast<const quint32 *> (a.constScanLine (y)) + x0,
+           reinterpret_cast<const quint32 *> (b.constScanLine (by)) + (x0 - offset.x ()),
+           dst + x0, x1 - x0) ;
+      memset (dst + x1, 0, (width - x1) * sizeof (quint32)) ;
+    }
+  }) ;
+  return out ;
+}
+
+QImage Kernels::transpose (const QImage & image) {
+  if (image.isNull ()) { return QImage () ; }
+
+  auto in = to_32bit (image) ;
+  QImage out (in.height (), in.width (), in.format ()) ;
+  auto blocks = transpose_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () != Isa::scalar) { blocks = transpose_sse2 ; }
+#endif
+
+  auto src = in.constBits () ;
+  auto dst = out.bits () ;
+  int src_stride = in.bytesPerLine (), dst_stride = out.bytesPerLine () ;
+  int width = in.width (), height = in.height () ;
+  // bands of whole 4 row blocks
+  for_rows ((height + 3) / 4, [&] (int begin, int end) {
+    blocks (src, src_stride, dst, dst_stride, width, 4 * begin, qMin (4 * end, height)) ;
+  }, 8) ;
+  return out ;
+}
+
+QImage Kernels::box_blur (const QImage & image, int radius) {
+  radius = qMin (radius, max_blur) ;
+  if (image.isNull () || radius < 1) { return image ; }
+
+  auto pass = box_pass_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { pass = box_pass_avx2 ; }
+  else if (isa () == Isa::sse2) { pass = box_pass_sse2 ; }
+#endif
+
+  // three vertical passes ; the horizontal ones run the same way on the
+  // transposed image, so both directions get the wide loads
+  auto vertical = [pass, radius] (const QImage & src) {
+    QImage a (src.size (), src.format ()), b (src.size (), src.format ()) ;
+    const uchar * from [3] = { src.constBits (), a.constBits (), b.constBits () } ;
+    uchar * to [3] = { a.bits (), b.bits (), a.bits () } ;
+    int stride = src.bytesPerLine (), height = src.height () ;
+    int row_bytes = src.width () * 4 ;
+
+    // strips of columns, each band runs all three passes over its own
+    // strips while they are still in cache
+    const int strip = 256 ;
+    for_rows ((row_bytes + strip - 1) / strip, [&] (int s0, int s1) {
+      QVector<quint16> sums (strip) ;
+      for (int s = s0 ; s < s1 ; s++) {
+        int begin = s * strip, end = qMin (begin + strip, row_bytes) ;
+        for (int k = 0 ; k < 3 ; k++) {
+          pass (BoxPass { from[k], to[k], stride, height, radius, sums.data () }, begin, end) ;
+        }
+      }
+    }, 1) ;
+    return a ;
+  } ;
+
+  return transpose (vertical (transpose (vertical (to_32bit (image))))) ;
+}
+
+QImage Kernels::halve (const QImage & image) {
+  if (image.width () < 2 || image.height () < 2) { return image ; }
+
+  auto in = to_32bit (image) ;
+  QImage out (in.width () / 2, in.height () / 2, in.format ()) ;
+  auto row = halve_row_scalar ;
+#ifdef IMVIEW_X86
+  if (isa () == Isa::avx2) { row = halve_row_avx2 ; }
+  else if (isa () == Isa::sse2) { row = halve_row_sse2 ; }
+#endif
+
+  auto dst = out.bits () ;
+  int stride = out.bytesPerLine (), width = out.width () ;
+  for_rows (out.height (), [&] (int begin, int end) {
+    for (int y = begin ; y < end ; y++) {
+      row (reinterpret_cast<const quint32 *> (in.constScanLine (2 * y)),
+           reinterpret_cast<const quint32 *> (in.constScanLine (2 * y + 1)),
+           reinterpret_cast<quint32 *> (dst + y * stride), width) ;
+    }
+  }) ;
+  return out ;
+}
@@ -1,6 +1,12 @@
 #include "Application.hpp"
 #include "MainWindow.hpp"
 #include "GraphicsView.hpp"
+#include "SplitView.hpp"
+#include "BoardView.hpp"
+#include "ImageCache.hpp"
+#include "PracticeTimer.hpp"
+#include "PaletteView.hpp"
+#include "HistogramView.hpp"
 
 #include <iostream>
 #include <QWidget>
@@ -21,6 +27,10 @@
 #include <QStringList>
 #include <QRegExp>
 #include <QDebug>
+#include <QActionGroup>
+#include <QDockWidget>
+#include <QRandomGenerator>
+#include <QStackedWidget>
 
 using std::cerr ;
 using std::endl ;
@@ -35,8 +45,13 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
   s_time = 350 ;
   l_time = 900 ;
 
-  auto gview = new GraphicsView (this) ;
-  setCentralWidget (gview) ;
+  // the views, or the board in their place
+  auto split = new SplitView () ;
+  auto board = new BoardView () ;
+  auto central = new QStackedWidget (this) ;
+  central->addWidget (split) ;
+  central->addWidget (board) ;
+  setCentralWidget (central) ;
 
   auto fileMenu = menuBar ()->addMenu (tr("&File")) ;
 
@@ -59,14 +74,6 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
       app->copy_current();
       });
 
-  connect (app, &Application::cmdline,
-      [] (const QString & line) {
-        if (line.startsWith ("newdir ")) {
-          QDir dir (line.mid (7)) ;
-          app->dir_selected (dir) ;
-        }
-      }) ;
-
   auto saveAction = fileMenu->addAction (tr("&Save")) ;
   saveAction->setShortcut (QKeySequence (tr("ctrl+s"))) ;
   connect (saveAction, &QAction::triggered,
@@ -100,6 +107,8 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
       auto ctx = app->current_context;
       if(ctx) {
         auto dir = ctx->dir;
+        app->cache->clear () ;
+        app->palettes->clear () ;
         app->on_context_deletion(ctx->id);
         app->dir_selected(dir);
       }
@@ -159,6 +168,111 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
       mirrorToggleAction->setChecked (value) ;
     }) ;
 
+  // squint : the slider sets the radius, the action turns it on and off
+  toolbar->addSeparator () ;
+  auto squintAction = toolbar->addAction ("Squint") ;
+  squintAction->setCheckable (true) ;
+  squintAction->setShortcut (QKeySequence (tr ("ctrl+b"))) ;
+  auto squintSlider = new QSlider (Qt::Horizontal) ;
+  squintSlider->setMinimum (1) ;
+  squintSlider->setMaximum (Filters::max_blur) ;
+  squintSlider->setValue (16) ;
+  squintSlider->setMaximumWidth (160) ;
+  squintSlider->setToolTip (tr ("Squint radius")) ;
+  toolbar->addWidget (squintSlider) ;
+
+  connect (squintAction, &QAction::triggered,
+    [squintSlider] (bool checked) {
+      app->on_blur (checked ? squintSlider->value () : 0) ;
+    }) ;
+  // follows the drag, every radius is cached once computed
+  connect (squintSlider, &QSlider::valueChanged,
+    [squintAction, squintSlider] (int value) {
+      if (squintAction->isChecked ()) {
+        app->on_blur (value, ! squintSlider->isSliderDown ()) ;
+      }
+    }) ;
+  connect (squintSlider, &QSlider::sliderReleased,
+    [squintAction] () {
+      if (squintAction->isChecked ()) { app->prefetch_upcoming () ; }
+    }) ;
+  connect (app, &Application::view_filter_changed,
+    [squintAction, squintSlider] () {
+      auto radius = app->view_filter.blur ;
+      squintAction->setChecked (radius > 0) ;
+      if (radius > 0) { squintSlider->setValue (radius) ; }
+    }) ;
+
+  // edges : the same, with the slider setting the threshold
+  auto edgesAction = toolbar->addAction ("Edges") ;
+  edgesAction->setCheckable (true) ;
+  edgesAction->setShortcut (QKeySequence (tr ("ctrl+e"))) ;
+  auto edgesSlider = new QSlider (Qt::Horizontal) ;
+  edgesSlider->setMinimum (1) ;
+  edgesSlider->setMaximum (255) ;
+  edgesSlider->setValue (48) ;
+  edgesSlider->setMaximumWidth (160) ;
+  edgesSlider->setToolTip (tr ("Edge threshold")) ;
+  toolbar->addWidget (edgesSlider) ;
+
+  connect (edgesAction, &QAction::triggered,
+    [edgesSlider] (bool checked) {
+      app->on_edges (checked ? edgesSlider->value () : 0) ;
+    }) ;
+  connect (edgesSlider, &QSlider::valueChanged,
+    [edgesAction] (int value) {
+      if (edgesAction->isChecked ()) { app->on_edges (value) ; }
+    }) ;
+  connect (app, &Application::edges_changed,
+    [edgesAction, edgesSlider] () {
+      auto threshold = app->edge_threshold ;
+      edgesAction->setChecked (threshold > 0) ;
+      if (threshold > 0) { edgesSlider->setValue (threshold) ; }
+    }) ;
+
+  // compare : a study over the reference, shift dragging moves it
+  toolbar->addSeparator () ;
+  auto compareAction = toolbar->addAction ("Compare") ;
+  compareAction->setCheckable (true) ;
+  compareAction->setShortcut (QKeySequence (tr ("ctrl+o"))) ;
+  auto compareSlider = new QSlider (Qt::Horizontal) ;
+  compareSlider->setMinimum (0) ;
+  compareSlider->setMaximum (100) ;
+  compareSlider->setValue (app->compare.opacity) ;
+  compareSlider->setMaximumWidth (160) ;
+  compareSlider->setToolTip (tr ("Comparison opacity")) ;
+  toolbar->addWidget (compareSlider) ;
+  auto differenceAction = toolbar->addAction ("Difference") ;
+  differenceAction->setCheckable (true) ;
+  differenceAction->setShortcut (QKeySequence (tr ("ctrl+d"))) ;
+
+  connect (compareAction, &QAction::triggered,
+    [this, compareAction] (bool checked) {
+      if (! checked) {
+        app->on_compare_open (QString ()) ;
+        return ;
+      }
+      auto ctx = app->current_context ;
+      auto file = QFileDialog::getOpenFileName (
+        this, tr ("Compare With"), ctx ? ctx->dir.absolutePath () : QString ("."),
+        tr ("Images (*.png *.jpg *.jpeg *.bmp *.gif *.tif *.tiff *.webp)")) ;
+      if (file.isEmpty ()) {
+        compareAction->setChecked (false) ;
+      } else {
+        app->on_compare_open (file) ;
+      }
+    }) ;
+  connect (compareSlider, &QSlider::valueChanged,
+    [] (int value) { app->on_compare_opacity (value) ; }) ;
+  connect (differenceAction, &QAction::triggered,
+    [] (bool checked) { app->on_compare_difference (checked) ; }) ;
+  connect (app, &Application::compare_changed,
+    [compareAction, compareSlider, differenceAction] () {
+      compareAction->setChecked (! app->compare.file.isEmpty ()) ;
+      compareSlider->setValue (app->compare.opacity) ;
+      differenceAction->setChecked (app->compare.difference) ;
+    }) ;
+
   auto smartNavigationToolbar = new QToolBar ("Smart Navigation") ;
   addToolBar (Qt::BottomToolBarArea, smartNavigationToolbar) ;
 
@@ -238,6 +352,22 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
     }) ;
 
   ctxTransDialog = new ContextTransformDialog (this) ;
+  auto shuffleAction = activitiesMenu->addAction (tr ("Shuffle")) ;
+  shuffleAction->setCheckable (true) ;
+  shuffleAction->setShortcut (QKeySequence (tr ("ctrl+r"))) ;
+  connect (shuffleAction, &QAction::triggered,
+    [] (bool checked) {
+      app->on_shuffle (checked, QRandomGenerator::global ()->generate ()) ;
+    }) ;
+
+  auto sync_shuffle = [shuffleAction] (Application::Context::Ptr ctx) {
+    if (ctx && ctx == app->current_context) {
+      shuffleAction->setChecked (ctx->shuffled) ;
+    }
+  } ;
+  connect (app, &Application::current_context_changed, sync_shuffle) ;
+  connect (app, &Application::context_changed, sync_shuffle) ;
+
   auto ctxTransformAction = activitiesMenu->addAction (tr ("Apply Context Transform")) ;
   connect (ctxTransformAction, &QAction::triggered,
     [this] () {
@@ -250,25 +380,39 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
 
   auto contextMenu = menuBar ()->addMenu ("Contexts") ;
 
-  connect (app, &Application::all_contexts_changed,
-    [contextMenu] (Application::Context::List ctxs) {
-      contextMenu->clear () ;
-
-      for (int i = 0 ; i < ctxs.size () ; i++) {
-        auto ctx = ctxs.at (i) ;
-        auto uid_str = ctx->id.toString () ;
-        auto dir_str = ctx->dir.dirName () ;
-        auto action = contextMenu->addAction (
-          QString ("%1: %2...")
-          .arg (ctx->id.toString ().mid (1, 5), 8)
-          .arg (ctx->dir.dirName ().left (15), 15)
-        ) ;
-        action->setData (QVariant (ctx->id)) ;
-
-        connect (action, &QAction::triggered,
-          [ctx] () { app->on_context_selection (ctx->id); }) ;
-      }
+  ctxSwitcher = new ContextSwitcher (this) ;
+  auto switchContextAction = contextMenu->addAction (tr ("Switch...")) ;
+  switchContextAction->setShortcut (QKeySequence (tr ("ctrl+k"))) ;
+  connect (switchContextAction, &QAction::triggered,
+    [this] () {
+      this->ctxSwitcher->popup () ;
+    }) ;
+
+  perfLabel = new QLabel (statusBar ()) ;
+  perfLabel->setVisible (false) ;
+  statusBar ()->addWidget (perfLabel) ;
+
+  auto perfOverlayAction = activitiesMenu->addAction (tr ("Performance Overlay")) ;
+  perfOverlayAction->setCheckable (true) ;
+  perfOverlayAction->setShortcut (QKeySequence (Qt::Key_F12)) ;
+  connect (perfOverlayAction, &QAction::toggled,
+    [this, split] (bool checked) {
+      for (auto view : split->views ()) { view->set_perf_overlay (checked) ; }
+      perfLabel->setText (app->perf.summary ()) ;
+      perfLabel->setVisible (checked) ;
+    }) ;
+
+
+  memLabel = new QLabel (statusBar ()) ;
+  statusBar ()->addPermanentWidget (memLabel) ;
+
+  memTimer = new QTimer (this) ;
+  memTimer->setSingleShot (false) ;
+  connect (memTimer, &QTimer::timeout,
+    [this] () {
+      memLabel->setText (app->mem.summary ()) ;
     }) ;
+  memTimer->start (1000) ;
 
   auto sbPrev = new QPushButton ("Prev") ;
   statusBar ()->addPermanentWidget (sbPrev) ;
@@ -296,12 +440,14 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
 
   connect (bnf1, &QTimer::timeout,
     [this] () {
+      app->perf.stamp_event () ;
       app->on_nextImage () ;
       bnf2->start (s_time) ;
     }) ;
 
   connect (bnf2, &QTimer::timeout,
     [] () {
+      app->perf.stamp_event () ;
       app->on_prevImage () ;
     }) ;
 
@@ -319,6 +465,77 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
       }
     }) ;
 
+  auto practiceMenu = activitiesMenu->addMenu (tr ("Practice Timer")) ;
+  auto practiceGroup = new QActionGroup (this) ;
+  for (int seconds : { 0, 30, 60, 120 }) {
+    auto label = seconds == 0 ? tr ("Off")
+      : seconds < 120 ? tr ("%1 s").arg (seconds) : tr ("%1 min").arg (seconds / 60) ;
+    auto action = practiceMenu->addAction (label) ;
+    action->setCheckable (true) ;
+    action->setChecked (seconds == 0) ;
+    practiceGroup->addAction (action) ;
+    connect (action, &QAction::triggered,
+      [seconds] () {
+        if (seconds > 0) { app->practice->start (seconds) ; }
+        else { app->practice->stop () ; }
+      }) ;
+  }
+
+  connect (app->practice, &PracticeTimer::transition,
+    [this] (int index, qint64 late_ns) {
+      statusBar ()->showMessage (QString ("practice : image %1, late by %2 ms")
+        .arg (index).arg (late_ns / 1e6, 0, 'f', 2), 2000) ;
+    }) ;
+
+  auto valueMenu = activitiesMenu->addMenu (tr ("Value Study")) ;
+  auto valueGroup = new QActionGroup (this) ;
+  const QStringList value_labels {
+    tr ("Off"), tr ("Grayscale"), tr ("Notan, 2 Values"), tr ("Notan, 3 Values"), tr ("Notan, 5 Values")
+  } ;
+  QList<QAction*> value_actions ;
+  for (int value = 0 ; value < Filters::value_count ; value++) {
+    auto action = valueMenu->addAction (value_labels.at (value)) ;
+    action->setCheckable (true) ;
+    action->setChecked (value == app->view_filter.value) ;
+    action->setShortcut (QKeySequence (tr ("alt+%1").arg (value))) ;
+    valueGroup->addAction (action) ;
+    value_actions << action ;
+    connect (action, &QAction::triggered,
+      [value] () { app->on_value_filter (value) ; }) ;
+  }
+
+  connect (app, &Application::view_filter_changed,
+    [value_actions] () {
+      value_actions.at (app->view_filter.value)->setChecked (true) ;
+    }) ;
+
+  auto paletteDock = new QDockWidget (tr ("Palette"), this) ;
+  paletteDock->setObjectName ("palette") ;
+  paletteDock->setWidget (new PaletteView (paletteDock)) ;
+  addDockWidget (Qt::RightDockWidgetArea, paletteDock) ;
+  paletteDock->hide () ;
+  auto paletteAction = paletteDock->toggleViewAction () ;
+  paletteAction->setShortcut (QKeySequence (tr ("ctrl+p"))) ;
+  activitiesMenu->addAction (paletteAction) ;
+  // palettes are only worked out while someone looks at them
+  connect (paletteDock, &QDockWidget::visibilityChanged,
+    [] (bool visible) {
+      app->palettes->enabled = visible ;
+      if (visible) { app->request_palette () ; }
+    }) ;
+
+  auto histogramDock = new QDockWidget (tr ("Histogram"), this) ;
+  histogramDock->setObjectName ("histogram") ;
+  auto histogramView = new HistogramView (histogramDock) ;
+  histogramDock->setWidget (histogramView) ;
+  addDockWidget (Qt::RightDockWidgetArea, histogramDock) ;
+  histogramDock->hide () ;
+  auto histogramAction = histogramDock->toggleViewAction () ;
+  histogramAction->setShortcut (QKeySequence (tr ("ctrl+h"))) ;
+  activitiesMenu->addAction (histogramAction) ;
+  connect (histogramDock, &QDockWidget::visibilityChanged,
+    histogramView, &HistogramView::set_active) ;
+
   auto incBFTimeAction = activitiesMenu->addAction (tr ("Increase Back-n-Forth Time")) ;
   incBFTimeAction->setShortcut (QKeySequence (Qt::Key_K)) ;
   auto decBFTimeAction = activitiesMenu->addAction (tr ("Decrease Back-n-Forth Time")) ;
@@ -362,23 +579,68 @@ MainWindow::MainWindow () : QMainWindow (nullptr) {
 
   setWindowTitle ("ImView-II") ;
 
-  connect (gview, &GraphicsView::log_no_context,
-    [this] () {
-      setWindowTitle (QString ("%1").arg (window_title)) ;
-    }) ;
+  // every view reports, only the active one refreshes
+  auto hook_view = [this, perfOverlayAction] (GraphicsView * view) {
+    view->set_perf_overlay (perfOverlayAction->isChecked ()) ;
 
-  connect (gview, &GraphicsView::log_no_images,
-    [this] () {
-      setWindowTitle (QString ("%1 (no images)").arg (window_title)) ;
-    }) ;
+    connect (view, &GraphicsView::switch_painted,
+      [this] () {
+        if (perfLabel->isVisible ()) {
+          perfLabel->setText (app->perf.summary ()) ;
+        }
+      }) ;
 
-  connect (gview, &GraphicsView::log_image_index,
-    [this] (int i, int t) {
-      setWindowTitle (QString ("%1 (%2/%3)")
-        .arg (window_title)
-        .arg (i)
-        .arg (t)) ;
-    }) ;
+    connect (view, &GraphicsView::log_no_context,
+      [this] () {
+        setWindowTitle (QString ("%1").arg (window_title)) ;
+      }) ;
+
+    connect (view, &GraphicsView::log_no_images,
+      [this] () {
+        setWindowTitle (QString ("%1 (no images)").arg (window_title)) ;
+      }) ;
+
+    connect (view, &GraphicsView::log_image_index,
+      [this] (int i, int t) {
+        setWindowTitle (QString ("%1 (%2/%3)")
+          .arg (window_title)
+          .arg (i)
+          .arg (t)) ;
+      }) ;
+  } ;
+  for (auto view : split->views ()) { hook_view (view) ; }
+  connect (split, &SplitView::view_added, hook_view) ;
+
+  auto splitAction = activitiesMenu->addAction (tr ("Split View")) ;
+  splitAction->setShortcut (QKeySequence (tr ("ctrl+\\"))) ;
+  connect (splitAction, &QAction::triggered, [split] () { split->add_view () ; }) ;
+  auto unsplitAction = activitiesMenu->addAction (tr ("Close View")) ;
+  unsplitAction->setShortcut (QKeySequence (tr ("ctrl+shift+\\"))) ;
+  connect (unsplitAction, &QAction::triggered, [split] () { split->remove_view () ; }) ;
+
+  auto boardAction = activitiesMenu->addAction (tr ("Board")) ;
+  boardAction->setCheckable (true) ;
+  boardAction->setShortcut (QKeySequence (tr ("ctrl+g"))) ;
+  connect (boardAction, &QAction::triggered,
+    [] (bool checked) { app->on_board (checked) ; }) ;
+  // built when shown, and again for another context while it is
+  auto show_board = [central, split, board, boardAction] () {
+    boardAction->setChecked (app->board) ;
+    if (app->board) {
+      board->show_context (app->current_context, app->board_images) ;
+      central->setCurrentWidget (board) ;
+      board->setFocus () ;
+    } else {
+      central->setCurrentWidget (split) ;
+      board->clear () ;
+      if (split->active ()) { split->active ()->setFocus () ; }
+      // navigation went on under the board, the view skipped it
+      if (app->current_context) { app->on_context_selection (app->current_context->id) ; }
+    }
+  } ;
+  connect (app, &Application::board_changed, show_board) ;
+  connect (app, &Application::current_context_changed,
+    [show_board] () { if (app->board) { show_board () ; } }) ;
 
   connect(app, &Application::status_bar_msg,
       [this](const QString &msg) {
@@ -0,0 +1,107 @@
+#include "MemStats.hpp"
+
+#include <QFile>
+
+#include <unistd.h>
+
+MemStats::MemStats () {
+  for (int i = 0 ; i < category_count ; i++) {
+    bytes[i].store (0) ;
+    peaks[i].store (0) ;
+  }
+  sum.store (0) ;
+  sum_peak.store (0) ;
+}
+
+const char * MemStats::category_name (int category) {
+  static const char * names[category_count] = {
+    "pixels", "mirrored", "clipboard", "cache", "filenames", "states", "sqlite", "board"
+  } ;
+  return category >= 0 && category < category_count ? names[category] : "?" ;
+}
+
+void MemStats::raise (std::atomic<qint64> & peak, qint64 value) {
+  auto seen = peak.load (std::memory_order_relaxed) ;
+  while (value > seen &&
+    ! peak.compare_exchange_weak (seen, value, std::memory_order_relaxed)) { }
+}
+
+void MemStats::set (Category category, qint64 value) {
+  auto old = bytes[category].exchange (value, std::memory_order_relaxed) ;
+  raise (peaks[category], value) ;
+  auto now = sum.fetch_add (value - old, std::memory_order_relaxed) + value - old ;
+  raise (sum_peak, now) ;
+}
+
+void MemStats::add (Category category, qint64 delta) {
+  auto value = bytes[category].fetch_add (delta, std::memory_order_relaxed) + delta ;
+  raise (peaks[category], value) ;
+  auto now = sum.fetch_add (delta, std::memory_order_relaxed) + delta ;
+  raise (sum_peak, now) ;
+}
+
+void MemStats::reset_peaks () {
+  for (int i = 0 ; i < category_count ; i++) {
+    peaks[i].store (bytes[i].load (std::memory_order_relaxed), std::memory_order_relaxed) ;
+  }
+  sum_peak.store (sum.load (std::memory_order_relaxed), std::memory_order_relaxed) ;
+}
+
+qint64 MemStats::current (int category) const {
+  return bytes[category].load (std::memory_order_relaxed) ;
+}
+
+qint64 MemStats::peak (int category) const {
+  return peaks[category].load (std::memory_order_relaxed) ;
+}
+
+qint64 MemStats::total () const {
+  return sum.load (std::memory_order_relaxed) ;
+}
+
+qint64 MemStats::total_peak () const {
+  return sum_peak.load (std::memory_order_relaxed) ;
+}
+
+qint64 MemStats::rss () {
+  // second field of statm : resident pages
+  QFile statm ("/proc/self/statm") ;
+  if (! statm.open (QIODevice::ReadOnly)) { return -1 ; }
+  auto fields = statm.readAll ().split (' ') ;
+  if (fields.size () < 2) { return -1 ; }
+  return fields.at (1).toLongLong () * sysconf (_SC_PAGESIZE) ;
+}
+
+qint64 MemStats::bytes_of (const QImage & image) {
+  return image.isNull () ? 0 : image.sizeInBytes () ;
+}
+
+qint64 MemStats::bytes_of (const QPixmap & pixmap) {
+  if (pixmap.isNull ()) { return 0 ; }
+  return static_cast<qint64> (pixmap.width ()) * pixmap.height () * pixmap.depth () / 8 ;
+}
+
+QJsonObject MemStats::to_json () const {
+  QJsonObject categories ;
+  for (int i = 0 ; i < category_count ; i++) {
+    QJsonObject obj ;
+    obj["bytes"] = static_cast<double> (current (i)) ;
+    obj["peak_bytes"] = static_cast<double> (peak (i)) ;
+    categories[category_name (i)] = obj ;
+  }
+
+  QJsonObject obj ;
+  obj["categories"] = categories ;
+  obj["bytes"] = static_cast<double> (total ()) ;
+  obj["peak_bytes"] = static_cast<double> (total_peak ()) ;
+  obj["rss_bytes"] = static_cast<double> (rss ()) ;
+  return obj ;
+}
+
+QString MemStats::summary () const {
+  auto mib = [] (qint64 bytes) { return QString::number (bytes / 1048576.0, 'f', 1) ; } ;
+  auto line = QString ("mem %1 MiB (peak %2)").arg (mib (total ())).arg (mib (total_peak ())) ;
+  auto resident = rss () ;
+  if (resident >= 0) { line += QString (", rss %1").arg (mib (resident)) ; }
+  return line ;
+}
@@ -0,0 +1,144 @@
+#include "Application.hpp"
+#include "GraphicsView.hpp"
+#include "NavBench.hpp"
+
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QJsonArray>
+
+#include <algorithm>
+#include <iostream>
+
+#include <sys/resource.h>
+
+using std::cerr ;
+using std::endl ;
+
+static qint64 peak_rss_kb () {
+  struct rusage usage ;
+  if (getrusage (RUSAGE_SELF, &usage) != 0) { return -1 ; }
+  return usage.ru_maxrss ;
+}
+
+NavBench::~NavBench () { }
+
+NavBench::NavBench (const QDir & dir) : dir (dir) { }
+
+bool NavBench::parse (const QString & sequence) {
+  steps.clear () ;
+
+  for (const auto & item : sequence.split (',', QString::SkipEmptyParts)) {
+    auto parts = item.trimmed ().split ('*') ;
+    int repeat = parts.size () > 1 ? parts.at (1).toInt () : 1 ;
+
+    auto op_parts = parts.at (0).split (':') ;
+    auto name = op_parts.at (0) ;
+    int arg = op_parts.size () > 1 ? op_parts.at (1).toInt () : 0 ;
+
+    Op op ;
+    if (name == "next") { op = Op::next ; }
+    else if (name == "prev") { op = Op::prev ; }
+    else if (name == "jump") { op = Op::jump ; }
+    else if (name == "goto") { op = Op::jump_to ; }
+    else if (name == "random") { op = Op::random ; }
+    else {
+      cerr << "bench : unknown step " << item.toStdString () << endl ;
+      return false ;
+    }
+
+    for (int i = 0 ; i < repeat ; i++) {
+      steps << Step { op, arg } ;
+    }
+  }
+
+  return ! steps.isEmpty () ;
+}
+
+QJsonObject NavBench::summarize (QVector<qint64> samples) {
+  QJsonObject obj ;
+  obj["count"] = samples.size () ;
+  if (samples.isEmpty ()) { return obj ; }
+
+  std::sort (samples.begin (), samples.end ()) ;
+  auto ms = [] (qint64 ns) { return ns / 1e6 ; } ;
+  auto at = [&samples] (double q) {
+    int i = static_cast<int> (q * (samples.size () - 1) + 0.5) ;
+    return samples.at (i) ;
+  } ;
+
+  qint64 total = 0 ;
+  for (auto s : samples) { total += s ; }
+
+  obj["mean_ms"] = ms (total / samples.size ()) ;
+  obj["p50_ms"] = ms (at (0.50)) ;
+  obj["p95_ms"] = ms (at (0.95)) ;
+  obj["p99_ms"] = ms (at (0.99)) ;
+  obj["max_ms"] = ms (samples.last ()) ;
+  obj["total_ms"] = ms (total) ;
+  return obj ;
+}
+
+QJsonObject NavBench::run () {
+  GraphicsView view ;
+  view.resize (800, 600) ;
+  view.show () ;
+
+  app->dir_selected (dir) ;
+  auto ctx = app->current_context ;
+  if (! ctx || ctx->images.size () == 0) {
+    cerr << "bench : no images in " << dir.absolutePath ().toStdString () << endl ;
+    return QJsonObject () ;
+  }
+
+  auto rss_before = peak_rss_kb () ;
+  QRandomGenerator random (0x1ac0) ;
+
+  QVector<qint64> switches, reads, decodes, uploads ;
+  QElapsedTimer wall ;
+  wall.start () ;
+
+  for (const auto & step : steps) {
+    int before = ctx->current_image_index ;
+    view.last_refresh = { 0, 0, 0 } ;
+
+    QElapsedTimer timer ;
+    timer.start () ;
+
+    switch (step.op) {
+      case Op::next : app->on_nextImage () ; break ;
+      case Op::prev : app->on_prevImage () ; break ;
+      case Op::jump : app->on_imgJump (step.arg) ; break ;
+      case Op::jump_to : app->on_imgJumpSpecific (step.arg) ; break ;
+      case Op::random :
+        app->on_imgJumpSpecific (random.bounded (ctx->images.size ())) ;
+        break ;
+    }
+
+    view.viewport ()->repaint () ;
+    auto elapsed = timer.nsecsElapsed () ;
+
+    // rotation-only steps in step modes do not change the image
+    if (ctx->current_image_index != before) {
+      switches << elapsed ;
+      reads << view.last_refresh.read ;
+      decodes << view.last_refresh.decode ;
+      uploads << view.last_refresh.upload ;
+    }
+  }
+
+  auto wall_ms = wall.nsecsElapsed () / 1e6 ;
+
+  QJsonObject result ;
+  result["dir"] = dir.absolutePath () ;
+  result["images"] = ctx->images.size () ;
+  result["steps"] = steps.size () ;
+  result["switch"] = summarize (switches) ;
+  result["read"] = summarize (reads) ;
+  result["decode"] = summarize (decodes) ;
+  result["upload"] = summarize (uploads) ;
+  result["wall_ms"] = wall_ms ;
+  result["switches_per_s"] = wall_ms > 0 ? switches.size () * 1000.0 / wall_ms : 0.0 ;
+  result["peak_rss_kb"] = peak_rss_kb () ;
+  result["peak_rss_before_kb"] = rss_before ;
+  return result ;
+}
@@ -0,0 +1,312 @@
+#include "Application.hpp"
+#include "Palette.hpp"
+#include "ImageCache.hpp"
+#include "Kernels.hpp"
+#include "Trace.hpp"
+
+#include <QRunnable>
+#include <QRandomGenerator>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QStringList>
+
+#include <algorithm>
+#include <limits>
+#include <iostream>
+
+using std::cerr ;
+using std::endl ;
+
+namespace {
+
+struct Point {
+  float r, g, b ;
+} ;
+
+inline float distance2 (const Point & a, const Point & b) {
+  float dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b ;
+  return dr * dr + dg * dg + db * db ;
+}
+
+int nearest (const Point & p, const QVector<Point> & centers) {
+  int best = 0 ;
+  float best_d = std::numeric_limits<float>::max () ;
+  for (int c = 0 ; c < centers.size () ; c++) {
+    auto d = distance2 (p, centers.at (c)) ;
+    if (d < best_d) { best_d = d ; best = c ; }
+  }
+  return best ;
+}
+
+bool cancelled (const std::atomic<bool> * cancel) {
+  return cancel && cancel->load (std::memory_order_relaxed) ;
+}
+
+class PaletteJob : public QRunnable {
+  public :
+
+  PaletteJob (PaletteService * service, const QString & file, qint64 mtime,
+    QSharedPointer<std::atomic<bool>> cancel)
+    : service (service), file (file), mtime (mtime), cancel (cancel) { }
+
+  virtual void run () {
+    TRACE_SCOPE ("palette") ;
+    Palette::Swatches swatches ;
+    if (! cancel->load ()) {
+      // whatever the view or prefetch decoded already
+      auto image = app->cache->get (file) ;
+      if (image.isNull ()) { image = ImageCache::decode (file) ; }
+
+      if (! image.isNull () && ! cancel->load ()) {
+        // around 128 pixels on the short side is plenty for a palette ;
+        // halved here, the cache is for levels the view will show
+        while (qMin (image.width (), image.height ()) >> 1 >= 128) {
+          image = Kernels::halve (image) ;
+        }
+        swatches = Palette::extract (image, Palette::colors, cancel.data ()) ;
+      }
+    }
+
+    auto service = this->service ;
+    auto file = this->file ;
+    auto mtime = this->mtime ;
+    auto cancel = this->cancel ;
+    QMetaObject::invokeMethod (service,
+      [service, file, mtime, cancel, swatches] () {
+        service->finished (file, mtime, cancel, swatches) ;
+      }, Qt::QueuedConnection) ;
+  }
+
+  PaletteService * service ;
+  QString file ;
+  qint64 mtime ;
+  QSharedPointer<std::atomic<bool>> cancel ;
+} ;
+
+qint64 mtime_of (const QString & file) {
+  return QFileInfo (file).lastModified ().toMSecsSinceEpoch () ;
+}
+
+}
+
+Palette::Swatches Palette::extract (const QImage & image, int k, const std::atomic<bool> * cancel) {
+  TRACE_SCOPE ("kmeans") ;
+  Swatches swatches ;
+  if (image.isNull () || k < 1) { return swatches ; }
+
+  // fully transparent pixels have no colour to speak of
+  auto in = Kernels::to_32bit (image) ;
+  bool alpha = in.hasAlphaChannel () ;
+  QVector<Point> points ;
+  points.reserve (in.width () * in.height ()) ;
+  for (int y = 0 ; y < in.height () ; y++) {
+    auto row = reinterpret_cast<const QRgb *> (in.constScanLine (y)) ;
+    for (int x = 0 ; x < in.width () ; x++) {
+      auto px = row[x] ;
+      if (alpha && qAlpha (px) < 128) { continue ; }
+      points << Point { float (qRed (px)), float (qGreen (px)), float (qBlue (px)) } ;
+    }
+  }
+  if (points.isEmpty ()) { return swatches ; }
+  k = qMin (k, points.size ()) ;
+
+  // k-means++ seeding, with a fixed seed so an image always gets the same
+  // palette
+  QRandomGenerator random (0x9a1e77e) ;
+  QVector<Point> centers ;
+  centers << points.at (random.bounded (points.size ())) ;
+  QVector<float> d2 (points.size ()) ;
+  while (centers.size () < k) {
+    double total = 0 ;
+    for (int i = 0 ; i < points.size () ; i++) {
+      d2[i] = distance2 (points.at (i), centers.at (nearest (points.at (i), centers))) ;
+      total += d2[i] ;
+    }
+    if (total <= 0) { break ; }
+    auto target = random.generateDouble () * total ;
+    int pick = 0 ;
+    for ( ; pick < points.size () - 1 ; pick++) {
+      target -= d2[pick] ;
+      if (target <= 0) { break ; }
+    }
+    centers << points.at (pick) ;
+  }
+  k = centers.size () ;
+
+  // Lloyd iterations, assignment split across threads with partial sums
+  // per band, merged at the end of it
+  QVector<int> label (points.size (), -1) ;
+  auto labels = label.data () ;
+  QVector<double> sums (4 * k) ;
+  const int max_iterations = 16 ;
+  for (int iteration = 0 ; iteration < max_iterations ; iteration++) {
+    if (cancelled (cancel)) { return Swatches () ; }
+
+    sums.fill (0) ;
+    std::atomic<int> changed (0) ;
+    QMutex merge ;
+    Kernels::for_rows (points.size (), [&] (int begin, int end) {
+      QVector<double> partial (4 * k, 0) ;
+      int moved = 0 ;
+      for (int i = begin ; i < end ; i++) {
+        const auto & p = points.at (i) ;
+        int c = nearest (p, centers) ;
+        if (c != labels[i]) { labels[i] = c ; moved++ ; }
+        partial[4 * c] += p.r ;
+        partial[4 * c + 1] += p.g ;
+        partial[4 * c + 2] += p.b ;
+        partial[4 * c + 3] += 1 ;
+      }
+      changed += moved ;
+      QMutexLocker lock (&merge) ;
+      for (int j = 0 ; j < partial.size () ; j++) { sums[j] += partial.at (j) ; }
+    }, 4096) ;
+
+    for (int c = 0 ; c < k ; c++) {
+      auto count = sums.at (4 * c + 3) ;
+      if (count > 0) {
+        centers[c] = Point { float (sums.at (4 * c) / count),
+          float (sums.at (4 * c + 1) / count), float (sums.at (4 * c + 2) / count) } ;
+      }
+    }
+
+    // settled once less than half a percent of the pixels move
+    if (changed.load () * 200 < points.size ()) { break ; }
+  }
+
+  for (int c = 0 ; c < k ; c++) {
+    auto count = sums.at (4 * c + 3) ;
+    if (count <= 0) { continue ; }
+    const auto & center = centers.at (c) ;
+    swatches << Swatch {
+      qRgb (qRound (center.r), qRound (center.g), qRound (center.b)),
+      float (count / points.size ()) } ;
+  }
+  std::sort (swatches.begin (), swatches.end (),
+    [] (const Swatch & a, const Swatch & b) { return a.share > b.share ; }) ;
+  return swatches ;
+}
+
+QString Palette::to_text (const Swatches & swatches) {
+  QStringList parts ;
+  for (const auto & swatch : swatches) {
+    parts << QString ("%1@%2")
+      .arg (QColor (swatch.color).name ())
+      .arg (qRound (swatch.share * 1000)) ;
+  }
+  return parts.join (' ') ;
+}
+
+Palette::Swatches Palette::from_text (const QString & text) {
+  Swatches swatches ;
+  for (const auto & part : text.split (' ', QString::SkipEmptyParts)) {
+    auto fields = part.split ('@') ;
+    QColor color (fields.value (0)) ;
+    if (fields.size () != 2 || ! color.isValid ()) { return Swatches () ; }
+    swatches << Swatch { color.rgb (), fields.at (1).toInt () / 1000.0f } ;
+  }
+  return swatches ;
+}
+
+PaletteService::PaletteService (QObject * parent)
+  : QObject (parent)
+  , enabled (false)
+{
+  // one at a time, palettes must not compete with decoding for the view
+  pool.setMaxThreadCount (1) ;
+}
+
+PaletteService::~PaletteService () {
+  for (auto & cancel : running) { cancel->store (true) ; }
+  pool.clear () ;
+  pool.waitForDone () ;
+}
+
+bool PaletteService::lookup (const QString & file, Palette::Swatches & swatches) {
+  auto iter = palettes.constFind (file) ;
+  if (iter != palettes.constEnd ()) {
+    swatches = iter.value () ;
+    return true ;
+  }
+
+  if (! QSqlDatabase::database ().isOpen ()) { return false ; }
+
+  QSqlQuery query ;
+  query.prepare ("select colors from palette where file=:file and mtime=:mtime") ;
+  query.bindValue (":file", file) ;
+  query.bindValue (":mtime", mtime_of (file)) ;
+  query.exec () ;
+  if (! query.next ()) { return false ; }
+
+  swatches = Palette::from_text (query.value (0).toString ()) ;
+  if (swatches.isEmpty ()) { return false ; }
+  palettes.insert (file, swatches) ;
+  return true ;
+}
+
+void PaletteService::request (const QString & file) {
+  if (! enabled) { return ; }
+
+  // left behind : they stop at their next check
+  for (auto iter = running.begin () ; iter != running.end () ; ) {
+    if (iter.key () != file) {
+      iter.value ()->store (true) ;
+      iter = running.erase (iter) ;
+    } else {
+      iter++ ;
+    }
+  }
+
+  Palette::Swatches swatches ;
+  if (lookup (file, swatches)) {
+    emit ready (file, swatches) ;
+  } else if (! running.contains (file)) {
+    start (file, 1) ;
+  }
+}
+
+void PaletteService::opportunistic (const QString & file) {
+  if (! enabled || running.contains (file) || palettes.contains (file)) { return ; }
+
+  Palette::Swatches swatches ;
+  if (! lookup (file, swatches)) { start (file, 0) ; }
+}
+
+void PaletteService::clear () {
+  for (auto & cancel : running) { cancel->store (true) ; }
+  running.clear () ;
+  palettes.clear () ;
+}
+
+void PaletteService::start (const QString & file, int priority) {
+  auto cancel = QSharedPointer<std::atomic<bool>>::create (false) ;
+  running.insert (file, cancel) ;
+  pool.start (new PaletteJob (this, file, mtime_of (file), cancel), priority) ;
+}
+
+void PaletteService::finished (const QString & file, qint64 mtime,
+  QSharedPointer<std::atomic<bool>> cancel, const Palette::Swatches & swatches)
+{
+  if (running.value (file) == cancel) { running.remove (file) ; }
+  if (cancel->load () || swatches.isEmpty ()) { return ; }
+
+  palettes.insert (file, swatches) ;
+
+  if (QSqlDatabase::database ().isOpen ()) {
+    QSqlQuery query ;
+    query.prepare ("insert or replace into palette (file, mtime, colors) values (:file, :mtime, :colors)") ;
+    query.bindValue (":file", file) ;
+    query.bindValue (":mtime", mtime) ;
+    query.bindValue (":colors", Palette::to_text (swatches)) ;
+    if (! query.exec ()) {
+      cerr << "Error storing palette : " << query.lastError ().text ().toStdString () << endl ;
+    }
+  }
+
+  emit ready (file, swatches) ;
+}
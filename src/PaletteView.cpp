@@ -0,0 +1,86 @@
+#include "Application.hpp"
+#include "PaletteView.hpp"
+
+#include <QPainter>
+#include <QMouseEvent>
+#include <QClipboard>
+#include <QGuiApplication>
+
+PaletteView::~PaletteView () { }
+
+PaletteView::PaletteView (QWidget * parent)
+  : QWidget (parent)
+{
+  connect (app, &Application::current_img_changed, this, &PaletteView::image_changed) ;
+  connect (app, &Application::current_context_changed, this, &PaletteView::image_changed) ;
+  connect (app->palettes, &PaletteService::ready, this, &PaletteView::ready) ;
+}
+
+QSize PaletteView::sizeHint () const {
+  return QSize (160, 240) ;
+}
+
+void PaletteView::image_changed () {
+  auto ctx = app->current_context ;
+  file = ctx && ctx->images.size () > 0
+    ? ctx->dir.absoluteFilePath (ctx->images.at (ctx->current_image_index))
+    : QString () ;
+  swatches.clear () ;
+  update () ;
+  // a known palette comes back right away
+  app->request_palette () ;
+}
+
+void PaletteView::ready (const QString & file, const Palette::Swatches & swatches) {
+  if (file != this->file) { return ; }
+  this->swatches = swatches ;
+  update () ;
+}
+
+QVector<QRect> PaletteView::bands () const {
+  // every band keeps room for its label, the rest goes by share
+  const int min_height = fontMetrics ().height () + 6 ;
+  int spare = qMax (0, height () - min_height * swatches.size ()) ;
+
+  QVector<QRect> rects ;
+  int y = 0 ;
+  for (int i = 0 ; i < swatches.size () ; i++) {
+    int h = min_height + static_cast<int> (spare * swatches.at (i).share) ;
+    if (i == swatches.size () - 1) { h = qMax (h, height () - y) ; }
+    rects << QRect (0, y, width (), h) ;
+    y += h ;
+  }
+  return rects ;
+}
+
+void PaletteView::paintEvent (QPaintEvent *) {
+  QPainter painter (this) ;
+  painter.fillRect (rect (), Qt::black) ;
+
+  if (swatches.isEmpty ()) {
+    painter.setPen (Qt::gray) ;
+    painter.drawText (rect (), Qt::AlignCenter, file.isEmpty () ? QString () : tr ("...")) ;
+    return ;
+  }
+
+  auto rects = bands () ;
+  for (int i = 0 ; i < swatches.size () ; i++) {
+    QColor color (swatches.at (i).color) ;
+    painter.fillRect (rects.at (i), color) ;
+    painter.setPen (color.lightness () > 140 ? Qt::black : Qt::white) ;
+    painter.drawText (rects.at (i).adjusted (6, 0, -6, 0), Qt::AlignVCenter | Qt::AlignLeft,
+      QString ("%1  %2%").arg (color.name ()).arg (qRound (swatches.at (i).share * 100))) ;
+  }
+}
+
+void PaletteView::mousePressEvent (QMouseEvent * evt) {
+  auto rects = bands () ;
+  for (int i = 0 ; i < rects.size () ; i++) {
+    if (rects.at (i).contains (evt->pos ())) {
+      auto name = QColor (swatches.at (i).color).name () ;
+      QGuiApplication::clipboard ()->setText (name) ;
+      app->show_status_bar_msg (QString ("copied %1").arg (name)) ;
+      return ;
+    }
+  }
+}
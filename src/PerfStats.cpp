@@ -0,0 +1,222 @@
+#include "PerfStats.hpp"
+
+#include <QtAlgorithms>
+#include <QJsonArray>
+
+#include <cmath>
+
+Histogram::Histogram () {
+  reset () ;
+}
+
+int Histogram::bucket_of (qint64 ns) {
+  // 256 ns units, so that the first bucket is everything under ~1 us and
+  // every other bucket has its two sub-bucket bits available
+  quint64 v = ns > 0 ? static_cast<quint64> (ns) >> 8 : 0 ;
+  if (v < 4) { return 0 ; }
+
+  int e = 63 - static_cast<int> (qCountLeadingZeroBits (v)) ;
+  int sub = static_cast<int> ((v >> (e - 2)) & 3) ;
+  return qMin (1 + (e - 2) * 4 + sub, buckets - 1) ;
+}
+
+qint64 Histogram::bucket_limit (int bucket) {
+  int next = bucket + 1 ;
+  int e = 2 + (next - 1) / 4 ;
+  int sub = (next - 1) % 4 ;
+  return (static_cast<qint64> (4 + sub) << (e - 2)) << 8 ;
+}
+
+void Histogram::record (qint64 ns) {
+  if (ns < 0) { ns = 0 ; }
+  counts[bucket_of (ns)].fetch_add (1, std::memory_order_relaxed) ;
+  total.fetch_add (1, std::memory_order_relaxed) ;
+  sum.fetch_add (ns, std::memory_order_relaxed) ;
+
+  auto seen = maximum.load (std::memory_order_relaxed) ;
+  while (ns > seen &&
+    ! maximum.compare_exchange_weak (seen, ns, std::memory_order_relaxed)) { }
+}
+
+void Histogram::reset () {
+  for (auto & count : counts) { count.store (0, std::memory_order_relaxed) ; }
+  total.store (0, std::memory_order_relaxed) ;
+  sum.store (0, std::memory_order_relaxed) ;
+  maximum.store (0, std::memory_order_relaxed) ;
+}
+
+quint64 Histogram::count () const {
+  return total.load (std::memory_order_relaxed) ;
+}
+
+qint64 Histogram::mean () const {
+  auto n = count () ;
+  return n > 0 ? sum.load (std::memory_order_relaxed) / static_cast<qint64> (n) : 0 ;
+}
+
+qint64 Histogram::max () const {
+  return maximum.load (std::memory_order_relaxed) ;
+}
+
+qint64 Histogram::percentile (double q) const {
+  // counts may move under us, go by what the buckets add up to
+  quint64 n = 0 ;
+  quint64 snapshot[buckets] ;
+  for (int i = 0 ; i < buckets ; i++) {
+    snapshot[i] = counts[i].load (std::memory_order_relaxed) ;
+    n += snapshot[i] ;
+  }
+  if (n == 0) { return 0 ; }
+
+  auto rank = static_cast<quint64> (std::ceil (q * n)) ;
+  if (rank < 1) { rank = 1 ; }
+
+  quint64 seen = 0 ;
+  for (int i = 0 ; i < buckets ; i++) {
+    seen += snapshot[i] ;
+    if (seen >= rank) { return qMin (bucket_limit (i), max ()) ; }
+  }
+  return max () ;
+}
+
+QJsonObject Histogram::to_json () const {
+  auto ms = [] (qint64 ns) { return ns / 1e6 ; } ;
+
+  QJsonObject obj ;
+  obj["count"] = static_cast<double> (count ()) ;
+  obj["mean_ms"] = ms (mean ()) ;
+  obj["p50_ms"] = ms (percentile (0.50)) ;
+  obj["p95_ms"] = ms (percentile (0.95)) ;
+  obj["p99_ms"] = ms (percentile (0.99)) ;
+  obj["max_ms"] = ms (max ()) ;
+  return obj ;
+}
+
+PerfStats::PerfStats ()
+  : event_start (-1)
+  , start (0)
+  , previous (0)
+  , in_flight (false)
+  , refreshed (false)
+{
+  clock.start () ;
+  for (int i = 0 ; i < stage_count ; i++) {
+    pending[i] = 0 ;
+    last_ns[i] = 0 ;
+  }
+}
+
+const char * PerfStats::stage_name (int stage) {
+  static const char * names[stage_count] = {
+    "event", "step", "state", "read", "decode", "upload", "scene", "paint", "total"
+  } ;
+  return stage >= 0 && stage < stage_count ? names[stage] : "?" ;
+}
+
+void PerfStats::stamp_event () {
+  event_start = clock.nsecsElapsed () ;
+}
+
+void PerfStats::begin () {
+  auto now = clock.nsecsElapsed () ;
+
+  for (auto & p : pending) { p = 0 ; }
+
+  // a stamp older than a second did not lead here
+  if (event_start >= 0 && now - event_start < 1000000000) {
+    start = event_start ;
+    pending[event] = now - event_start ;
+  } else {
+    start = now ;
+  }
+  event_start = -1 ;
+
+  previous = now ;
+  in_flight = true ;
+  refreshed = false ;
+}
+
+void PerfStats::mark (Stage stage) {
+  if (! in_flight) { return ; }
+
+  auto now = clock.nsecsElapsed () ;
+  pending[stage] += now - previous ;
+  previous = now ;
+
+  if (stage == upload) { refreshed = true ; }
+}
+
+bool PerfStats::finish () {
+  if (! in_flight) { return false ; }
+
+  // a rotation only step, or a refresh that found no image
+  if (! refreshed) {
+    cancel () ;
+    return false ;
+  }
+
+  mark (paint) ;
+  pending[total] = previous - start ;
+
+  for (int i = 0 ; i < stage_count ; i++) {
+    histograms[i].record (pending[i]) ;
+    last_ns[i] = pending[i] ;
+  }
+
+  in_flight = false ;
+  return true ;
+}
+
+void PerfStats::cancel () {
+  in_flight = false ;
+  refreshed = false ;
+}
+
+bool PerfStats::active () const {
+  return in_flight ;
+}
+
+void PerfStats::reset () {
+  for (auto & histogram : histograms) { histogram.reset () ; }
+  for (auto & l : last_ns) { l = 0 ; }
+}
+
+const Histogram & PerfStats::histogram (int stage) const {
+  return histograms[stage] ;
+}
+
+qint64 PerfStats::last (int stage) const {
+  return last_ns[stage] ;
+}
+
+quint64 PerfStats::switches () const {
+  return histograms[total].count () ;
+}
+
+QJsonObject PerfStats::to_json () const {
+  QJsonObject stages ;
+  for (int i = 0 ; i < stage_count ; i++) {
+    auto obj = histograms[i].to_json () ;
+    obj["last_ms"] = last_ns[i] / 1e6 ;
+    stages[stage_name (i)] = obj ;
+  }
+
+  QJsonObject obj ;
+  obj["switches"] = static_cast<double> (switches ()) ;
+  obj["stages"] = stages ;
+  return obj ;
+}
+
+QString PerfStats::summary () const {
+  const auto & t = histograms[total] ;
+  if (t.count () == 0) { return QString () ; }
+
+  auto ms = [] (qint64 ns) { return QString::number (ns / 1e6, 'f', 1) ; } ;
+  return QString ("switch %1 ms (read %2, decode %3, upload %4)  p50 %5  p95 %6")
+    .arg (ms (last_ns[total]))
+    .arg (ms (last_ns[read]))
+    .arg (ms (last_ns[decode]))
+    .arg (ms (last_ns[upload]))
+    .arg (ms (t.percentile (0.50)))
+    .arg (ms (t.percentile (0.95))) ;
+}
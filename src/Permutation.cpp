@@ -0,0 +1,77 @@
+#include "Permutation.hpp"
+
+static quint32 mix (quint32 x) {
+  // lowbias32
+  x ^= x >> 16 ;
+  x *= 0x7feb352dU ;
+  x ^= x >> 15 ;
+  x *= 0x846ca68bU ;
+  x ^= x >> 16 ;
+  return x ;
+}
+
+Permutation::Permutation () : Permutation (0, 0) { }
+
+Permutation::Permutation (quint32 size, quint32 seed)
+  : count (size)
+  , key (seed)
+  , half_bits (1)
+{
+  while ((quint64 (1) << (2 * half_bits)) < size) { half_bits++ ; }
+  half_mask = (quint32 (1) << half_bits) - 1 ;
+
+  auto state = seed ;
+  for (int i = 0 ; i < rounds ; i++) {
+    state = mix (state + 0x9e3779b9U * (i + 1)) ;
+    keys[i] = state ;
+  }
+}
+
+quint32 Permutation::size () const {
+  return count ;
+}
+
+quint32 Permutation::seed () const {
+  return key ;
+}
+
+quint32 Permutation::round (quint32 half, int i) const {
+  return mix (half ^ keys[i]) & half_mask ;
+}
+
+quint32 Permutation::encrypt (quint32 value) const {
+  quint32 left = value >> half_bits ;
+  quint32 right = value & half_mask ;
+  for (int i = 0 ; i < rounds ; i++) {
+    auto next = left ^ round (right, i) ;
+    left = right ;
+    right = next ;
+  }
+  return (left << half_bits) | right ;
+}
+
+quint32 Permutation::decrypt (quint32 value) const {
+  quint32 left = value >> half_bits ;
+  quint32 right = value & half_mask ;
+  for (int i = rounds - 1 ; i >= 0 ; i--) {
+    auto previous = right ^ round (left, i) ;
+    right = left ;
+    left = previous ;
+  }
+  return (left << half_bits) | right ;
+}
+
+// the domain is less than 4 times size, so walks are short
+quint32 Permutation::at (quint32 position) const {
+  if (count == 0) { return 0 ; }
+  auto value = encrypt (position % count) ;
+  while (value >= count) { value = encrypt (value) ; }
+  return value ;
+}
+
+quint32 Permutation::position_of (quint32 element) const {
+  if (count == 0) { return 0 ; }
+  auto value = decrypt (element % count) ;
+  while (value >= count) { value = decrypt (value) ; }
+  return value ;
+}
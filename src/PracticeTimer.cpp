@@ -0,0 +1,109 @@
+#include "Application.hpp"
+#include "PracticeTimer.hpp"
+
+#include <iostream>
+
+using std::cerr ;
+using std::endl ;
+
+// the timer is armed this much early, the rest is waited out exactly
+static const qint64 spin_ns = 2000000 ;
+
+PracticeTimer::~PracticeTimer () { }
+
+PracticeTimer::PracticeTimer (QObject * parent)
+  : QObject (parent)
+  , timer (new QTimer (this))
+  , interval_ns (0)
+  , deadline_ns (0)
+  , transitions (0)
+{
+  timer->setSingleShot (true) ;
+  timer->setTimerType (Qt::PreciseTimer) ;
+  connect (timer, &QTimer::timeout, this, &PracticeTimer::on_deadline) ;
+}
+
+void PracticeTimer::start (int seconds) {
+  stop () ;
+  if (seconds <= 0) { return ; }
+
+  interval_ns = static_cast<qint64> (seconds) * 1000000000 ;
+  transitions = 0 ;
+  lateness.reset () ;
+
+  clock.start () ;
+  deadline_ns = interval_ns ;
+  prefetch_upcoming () ;
+  arm () ;
+}
+
+void PracticeTimer::stop () {
+  if (! active ()) { return ; }
+
+  timer->stop () ;
+  interval_ns = 0 ;
+
+  if (lateness.count () > 0) {
+    cerr << "practice : " << lateness.count () << " transitions, late by p50 "
+         << lateness.percentile (0.50) / 1e6 << " / p95 "
+         << lateness.percentile (0.95) / 1e6 << " / max "
+         << lateness.max () / 1e6 << " ms" << endl ;
+  }
+  emit stopped () ;
+}
+
+bool PracticeTimer::active () const {
+  return interval_ns > 0 ;
+}
+
+int PracticeTimer::interval () const {
+  return static_cast<int> (interval_ns / 1000000000) ;
+}
+
+qint64 PracticeTimer::remaining_ms () const {
+  if (! active ()) { return 0 ; }
+  return qMax<qint64> (0, (deadline_ns - clock.nsecsElapsed ()) / 1000000) ;
+}
+
+const Histogram & PracticeTimer::jitter () const {
+  return lateness ;
+}
+
+void PracticeTimer::arm () {
+  auto wait_ns = deadline_ns - spin_ns - clock.nsecsElapsed () ;
+  timer->start (static_cast<int> (qMax<qint64> (0, wait_ns / 1000000))) ;
+}
+
+void PracticeTimer::prefetch_upcoming () {
+  // in step modes the next call may only rotate, prefetching early is
+  // harmless since the cache keeps it until the image comes up
+  app->prefetch_upcoming () ;
+}
+
+void PracticeTimer::on_deadline () {
+  if (! active ()) { return ; }
+  app->perf.stamp_event () ;
+
+  // precise timers still wake up a little early or late, absorb the early
+  // part here rather than a whole event loop round later
+  while (clock.nsecsElapsed () < deadline_ns) { }
+
+  auto late = clock.nsecsElapsed () - deadline_ns ;
+  app->on_nextImage () ;
+  lateness.record (late) ;
+  transitions++ ;
+
+  auto ctx = app->current_context ;
+  int index = ctx ? ctx->current_image_index : -1 ;
+  cerr << "practice : transition " << transitions << " to image " << index
+       << ", late by " << late / 1e3 << " us, switch took "
+       << (clock.nsecsElapsed () - deadline_ns - late) / 1e6 << " ms" << endl ;
+  emit transition (index, late) ;
+
+  // a deadline missed entirely is skipped, not made up for
+  auto now = clock.nsecsElapsed () ;
+  do { deadline_ns += interval_ns ; } while (deadline_ns <= now) ;
+
+  prefetch_upcoming () ;
+  arm () ;
+}
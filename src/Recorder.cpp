@@ -0,0 +1,301 @@
+#include "Application.hpp"
+#include "GraphicsView.hpp"
+#include "NavBench.hpp"
+#include "Recorder.hpp"
+
+#include <QThread>
+#include <QJsonArray>
+
+#include <iostream>
+
+using std::cerr ;
+using std::endl ;
+
+static const quint32 magic = 0x494d5652 ;   // "IMVR"
+static const quint16 format_version = 1 ;
+
+Recorder::Recorder () : last_us (0), depth (0) { }
+
+Recorder::~Recorder () {
+  close () ;
+}
+
+bool Recorder::open (const QString & name) {
+  file.setFileName (name) ;
+  if (! file.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+    cerr << "record : cannot write " << name.toStdString () << endl ;
+    return false ;
+  }
+
+  out.setDevice (&file) ;
+  out.setVersion (QDataStream::Qt_5_6) ;
+  out.setFloatingPointPrecision (QDataStream::SinglePrecision) ;
+  out << magic << format_version ;
+
+  clock.start () ;
+  last_us = 0 ;
+  return true ;
+}
+
+void Recorder::close () {
+  if (file.isOpen ()) {
+    out.setDevice (nullptr) ;
+    file.close () ;
+  }
+}
+
+int Recorder::args_of (Op op) {
+  switch (op) {
+    case Op::move_grab : case Op::move_ungrab :
+    case Op::scale_grab : case Op::scale_ungrab :
+    case Op::drag : case Op::push_translate :
+    case Op::context_rot_mirror : case Op::shuffle : case Op::compare_offset :
+      return 2 ;
+    case Op::rotation : case Op::zoom :
+    case Op::jump : case Op::jump_specific : case Op::step_mode :
+    case Op::value_filter : case Op::blur : case Op::edges :
+    case Op::compare_opacity : case Op::compare_difference : case Op::board :
+      return 1 ;
+    default :
+      return 0 ;
+  }
+}
+
+bool Recorder::has_path (Op op) {
+  return op == Op::open_dir || op == Op::select_dir || op == Op::close_dir
+    || op == Op::compare_open || op == Op::board ;
+}
+
+const char * Recorder::op_name (Op op) {
+  static const char * names[] = {
+    "open_dir", "select_dir", "close_dir",
+    "move_grab", "move_ungrab", "scale_grab", "scale_ungrab", "drag", "push_translate",
+    "rotation", "discrete_rotation", "zoom", "mirror_toggle",
+    "next_image", "prev_image", "jump", "jump_specific", "step_mode",
+    "context_rot_mirror", "transform_others", "resize", "save", "shuffle",
+    "value_filter", "blur", "edges",
+    "compare_open", "compare_opacity", "compare_difference", "compare_offset",
+    "board"
+  } ;
+  auto index = static_cast<size_t> (op) ;
+  return index < sizeof (names) / sizeof (names[0]) ? names[index] : "?" ;
+}
+
+void Recorder::record (Op op, double a, double b, const QString & path) {
+  if (! file.isOpen ()) { return ; }
+
+  auto now_us = clock.nsecsElapsed () / 1000 ;
+  auto delta = qBound<qint64> (0, now_us - last_us, 0xffffffff) ;
+  last_us = now_us ;
+
+  out << static_cast<quint8> (op) << static_cast<quint32> (delta) ;
+  int args = args_of (op) ;
+  if (args > 0) { out << a ; }
+  if (args > 1) { out << b ; }
+  if (has_path (op)) { out << path ; }
+
+  // saves are rare, and keep what was recorded so far safe
+  if (op == Op::save) { file.flush () ; }
+}
+
+bool Recorder::load (const QString & name, QVector<Event> & events) {
+  QFile in_file (name) ;
+  if (! in_file.open (QIODevice::ReadOnly)) {
+    cerr << "replay : cannot read " << name.toStdString () << endl ;
+    return false ;
+  }
+
+  QDataStream in (&in_file) ;
+  in.setVersion (QDataStream::Qt_5_6) ;
+  in.setFloatingPointPrecision (QDataStream::SinglePrecision) ;
+
+  quint32 file_magic = 0 ;
+  quint16 version = 0 ;
+  in >> file_magic >> version ;
+  if (file_magic != magic || version != format_version) {
+    cerr << "replay : not a recording " << name.toStdString () << endl ;
+    return false ;
+  }
+
+  events.clear () ;
+  qint64 time_us = 0 ;
+  while (! in.atEnd ()) {
+    quint8 op_byte = 0 ;
+    quint32 delta = 0 ;
+    in >> op_byte >> delta ;
+
+    Event event { 0, static_cast<Op> (op_byte), 0, 0, QString () } ;
+    if (op_byte > static_cast<quint8> (Op::board)) {
+      cerr << "replay : unknown op " << int (op_byte) << endl ;
+      return false ;
+    }
+
+    int args = args_of (event.op) ;
+    if (args > 0) { in >> event.a ; }
+    if (args > 1) { in >> event.b ; }
+    if (has_path (event.op)) { in >> event.path ; }
+
+    if (in.status () != QDataStream::Ok) {
+      cerr << "replay : truncated recording, keeping "
+           << events.size () << " calls" << endl ;
+      break ;
+    }
+
+    time_us += delta ;
+    event.time_us = time_us ;
+    events << event ;
+  }
+
+  return true ;
+}
+
+Recorder::Scope::Scope (Recorder * recorder, Op op, double a, double b,
+  const QString & path)
+  : recorder (recorder)
+{
+  if (recorder && recorder->depth++ == 0) {
+    recorder->record (op, a, b, path) ;
+  }
+}
+
+Recorder::Scope::~Scope () {
+  if (recorder) { recorder->depth-- ; }
+}
+
+Replayer::~Replayer () { }
+
+Replayer::Replayer (const QVector<Recorder::Event> & events) : events (events) { }
+
+static Application::Context::Ptr context_of (const QString & path) {
+  for (const auto & ctx : app->all_contexts) {
+    if (ctx->dir.absolutePath () == path) { return ctx ; }
+  }
+  return nullptr ;
+}
+
+bool Replayer::dispatch (const Recorder::Event & event) {
+  typedef Recorder::Op Op ;
+
+  switch (event.op) {
+    case Op::open_dir :
+    case Op::select_dir : {
+      if (event.path.isEmpty ()) { break ; }
+      if (! QDir (event.path).exists ()) {
+        cerr << "replay : no directory " << event.path.toStdString () << endl ;
+        return false ;
+      }
+      auto ctx = context_of (event.path) ;
+      if (event.op == Op::select_dir && ctx) {
+        app->on_context_selection (ctx->id) ;
+      } else {
+        app->dir_selected (QDir (event.path)) ;
+      }
+      break ;
+    }
+    case Op::close_dir : {
+      auto ctx = context_of (event.path) ;
+      if (ctx) { app->on_context_deletion (ctx->id) ; }
+      break ;
+    }
+    case Op::move_grab : app->move_grab (event.a, event.b) ; break ;
+    case Op::move_ungrab : app->move_ungrab (event.a, event.b) ; break ;
+    case Op::scale_grab : app->scale_grab (event.a, event.b) ; break ;
+    case Op::scale_ungrab : app->scale_ungrab (event.a, event.b) ; break ;
+    case Op::drag : app->drag (event.a, event.b) ; break ;
+    case Op::push_translate : app->push_translate (event.a, event.b) ; break ;
+    case Op::rotation : app->on_rotation (event.a) ; break ;
+    case Op::discrete_rotation : app->on_discrete_rotation () ; break ;
+    case Op::zoom : app->on_zoom (event.a) ; break ;
+    case Op::mirror_toggle : app->on_mirrorToggle () ; break ;
+    case Op::next_image : app->on_nextImage () ; break ;
+    case Op::prev_image : app->on_prevImage () ; break ;
+    case Op::jump : app->on_imgJump (static_cast<int> (event.a)) ; break ;
+    case Op::jump_specific : app->on_imgJumpSpecific (static_cast<int> (event.a)) ; break ;
+    case Op::step_mode :
+      app->on_stepModeChange (int_to_stepmode (static_cast<int> (event.a))) ;
+      break ;
+    case Op::context_rot_mirror :
+      app->on_context_wide_rot_mirror (event.a, event.b != 0) ;
+      break ;
+    case Op::transform_others : app->on_transform_others () ; break ;
+    case Op::resize : app->on_resize () ; break ;
+    case Op::save : app->flush_to_db () ; break ;
+    case Op::shuffle : {
+      // a is -1 when shuffling was turned off, there is no seed then
+      quint32 seed = 0 ;
+      if (event.a >= 0) {
+        seed = (static_cast<quint32> (event.a) << 16) | static_cast<quint32> (event.b) ;
+      }
+      app->on_shuffle (event.a >= 0, seed) ;
+      break ;
+    }
+    case Op::value_filter : app->on_value_filter (static_cast<int> (event.a)) ; break ;
+    case Op::blur : app->on_blur (static_cast<int> (event.a)) ; break ;
+    case Op::edges : app->on_edges (static_cast<int> (event.a)) ; break ;
+    case Op::compare_open : app->on_compare_open (event.path) ; break ;
+    case Op::compare_opacity : app->on_compare_opacity (static_cast<int> (event.a)) ; break ;
+    case Op::compare_difference : app->on_compare_difference (event.a != 0) ; break ;
+    case Op::compare_offset : app->on_compare_offset (event.a, event.b) ; break ;
+    case Op::board : {
+      QVector<int> images ;
+      for (const auto & index : event.path.split (' ', QString::SkipEmptyParts)) {
+        images << index.toInt () ;
+      }
+      app->on_board (event.a != 0, images) ;
+      break ;
+    }
+  }
+
+  return true ;
+}
+
+QJsonObject Replayer::run (bool realtime) {
+  GraphicsView view ;
+  view.resize (800, 600) ;
+  view.show () ;
+
+  QHash<int,QVector<qint64>> per_op ;
+  QVector<qint64> frames, flushes ;
+
+  QElapsedTimer wall ;
+  wall.start () ;
+
+  for (const auto & event : events) {
+    if (realtime) {
+      auto wait_us = event.time_us - wall.nsecsElapsed () / 1000 ;
+      if (wait_us > 0) { QThread::usleep (static_cast<unsigned long> (wait_us)) ; }
+    }
+
+    QElapsedTimer timer ;
+    timer.start () ;
+
+    if (! dispatch (event)) { return QJsonObject () ; }
+    if (event.op == Recorder::Op::save) { flushes << timer.nsecsElapsed () ; }
+
+    view.viewport ()->repaint () ;
+    auto elapsed = timer.nsecsElapsed () ;
+
+    frames << elapsed ;
+    per_op[static_cast<int> (event.op)] << elapsed ;
+  }
+
+  auto wall_ms = wall.nsecsElapsed () / 1e6 ;
+
+  QJsonObject ops ;
+  for (auto iter = per_op.constBegin () ; iter != per_op.constEnd () ; iter++) {
+    ops[Recorder::op_name (static_cast<Recorder::Op> (iter.key ()))] =
+      NavBench::summarize (iter.value ()) ;
+  }
+
+  QJsonObject result ;
+  result["calls"] = events.size () ;
+  result["recorded_ms"] = events.isEmpty () ? 0.0 : events.last ().time_us / 1e3 ;
+  result["wall_ms"] = wall_ms ;
+  result["realtime"] = realtime ;
+  result["frame"] = NavBench::summarize (frames) ;
+  result["flush"] = NavBench::summarize (flushes) ;
+  result["ops"] = ops ;
+  result["perf"] = app->perf.to_json () ;
+  result["mem"] = app->mem.to_json () ;
+  return result ;
+}
@@ -0,0 +1,143 @@
+#include "Application.hpp"
+#include "SplitView.hpp"
+#include "GraphicsView.hpp"
+#include "ImageCache.hpp"
+#include "Recorder.hpp"
+
+SplitView::SplitView (QWidget * parent)
+  : QSplitter (Qt::Horizontal, parent)
+{
+  setChildrenCollapsible (false) ;
+
+  auto view = new GraphicsView (this) ;
+  addWidget (view) ;
+  panes << Pane { view, Application::Context::Ptr (), -1, Application::ImageState () } ;
+  connect (view, &GraphicsView::focused, this, [this, view] () { activate (view) ; }) ;
+  app->active_view = view ;
+
+  connect (app, &Application::current_img_changed, this, &SplitView::prefetch_others) ;
+
+  // a view left on a closed context comes back on the current one
+  connect (app, &Application::context_removed,
+    [this] (QUuid id) {
+      for (auto & pane : panes) {
+        if (pane.context && pane.context->id == id) { pane.context.reset () ; }
+      }
+    }) ;
+}
+
+SplitView::~SplitView () {
+  app->active_view = nullptr ;
+}
+
+GraphicsView * SplitView::add_view () {
+  auto view = new GraphicsView (this) ;
+  addWidget (view) ;
+  panes << Pane { view, Application::Context::Ptr (), -1, Application::ImageState () } ;
+  connect (view, &GraphicsView::focused, this, [this, view] () { activate (view) ; }) ;
+
+  // same share for every view
+  QList<int> sizes ;
+  for (int i = 0 ; i < count () ; i++) { sizes << width () / count () ; }
+  setSizes (sizes) ;
+  emit view_added (view) ;
+
+  view->setFocus () ;
+  activate (view) ;
+  return view ;
+}
+
+void SplitView::remove_view () {
+  if (panes.size () < 2) { return ; }
+
+  auto leaving = active () ;
+  auto next = panes.at (0).view == leaving ? panes.at (1).view : panes.at (0).view ;
+  activate (next) ;
+  next->setFocus () ;
+
+  for (int i = 0 ; i < panes.size () ; i++) {
+    if (panes.at (i).view == leaving) { panes.remove (i) ; break ; }
+  }
+  leaving->deleteLater () ;
+}
+
+GraphicsView * SplitView::active () const {
+  for (const auto & pane : panes) {
+    if (pane.view == app->active_view) { return pane.view ; }
+  }
+  return nullptr ;
+}
+
+QVector<GraphicsView *> SplitView::views () const {
+  QVector<GraphicsView *> result ;
+  for (const auto & pane : panes) { result << pane.view ; }
+  return result ;
+}
+
+SplitView::Pane * SplitView::pane_of (GraphicsView * view) {
+  for (auto & pane : panes) {
+    if (pane.view == view) { return &pane ; }
+  }
+  return nullptr ;
+}
+
+void SplitView::activate (GraphicsView * view) {
+  auto incoming = pane_of (view) ;
+  if (! incoming || app->active_view == view) { return ; }
+
+  auto outgoing = pane_of (active ()) ;
+  if (outgoing) {
+    outgoing->context = app->current_context ;
+    outgoing->index = app->current_context ? app->current_context->current_image_index : -1 ;
+    if (app->current_state) { outgoing->state = *app->current_state ; }
+  }
+
+  app->active_view = view ;
+
+  auto ctx = incoming->context ;
+  if (! ctx || app->find_context (ctx->id) != ctx) {
+    // a new view, it starts where the others are
+    ctx = app->current_context ;
+    incoming->context = ctx ;
+    incoming->index = ctx ? ctx->current_image_index : -1 ;
+    if (app->current_state) { incoming->state = *app->current_state ; }
+  }
+
+  // the transform is its own : the other view may have changed the state
+  // of the same image since, which stays as it was saved
+  bool jumped = false ;
+  if (ctx && incoming->index >= 0 && incoming->index < ctx->images.size ()
+    && ctx->current_image_index != incoming->index)
+  {
+    // saved like any other move ; set before the selection, so the view
+    // refreshes once, on the right image
+    ctx->current_image_index = incoming->index ;
+    app->context_is_dirty (ctx) ;
+    jumped = true ;
+  }
+  app->override_state (ctx, incoming->index, incoming->state) ;
+
+  // the view redraws from the cache, the image is decoded already
+  app->on_context_selection (ctx ? ctx->id : QUuid ()) ;
+  // replayed after the selection it goes with
+  if (jumped && app->recorder) {
+    app->recorder->record (Recorder::Op::jump_specific, incoming->index, 0, QString ()) ;
+  }
+}
+
+void SplitView::prefetch_others () {
+  for (const auto & pane : panes) {
+    auto ctx = pane.context ;
+    if (pane.view == app->active_view || ! ctx || ctx->images.size () == 0) { continue ; }
+    if (pane.index < 0 || pane.index >= ctx->images.size ()) { continue ; }
+
+    // what the view shows stays recent, and its next step is ready
+    app->cache->prefetch (ctx->dir.absoluteFilePath (ctx->images.at (pane.index)),
+      pane.state.scale (), app->view_filter) ;
+    auto next = ctx->upcoming_index (pane.index, 1) ;
+    if (next >= 0 && next != pane.index) {
+      app->cache->prefetch (ctx->dir.absoluteFilePath (ctx->images.at (next)),
+        ctx->effective_state (next).scale (), app->view_filter) ;
+    }
+  }
+}
@@ -0,0 +1,145 @@
+#include "Trace.hpp"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonDocument>
+
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using std::cerr ;
+using std::endl ;
+
+std::atomic<bool> Trace::on { false } ;
+
+namespace {
+
+struct Span {
+  const char * name ;
+  qint64 start ;
+  qint64 duration ;
+} ;
+
+// only the owning thread writes ; head is published with release so a
+// dump sees complete spans, except those being overwritten while it reads
+struct ThreadBuffer {
+  ThreadBuffer (int tid, const QString & name)
+    : spans (Trace::capacity), head (0), tid (tid), name (name) { }
+
+  QVector<Span> spans ;
+  std::atomic<quint64> head ;
+  int tid ;
+  QString name ;
+} ;
+
+struct Registry {
+  QMutex mutex ;
+  QElapsedTimer epoch ;
+  // buffers outlive their threads, so spans of finished workers still dump
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers ;
+} ;
+
+Registry & registry () {
+  static Registry instance ;
+  return instance ;
+}
+
+thread_local ThreadBuffer * local_buffer = nullptr ;
+
+ThreadBuffer * thread_buffer () {
+  if (! local_buffer) {
+    auto & reg = registry () ;
+    QMutexLocker lock (&reg.mutex) ;
+
+    int tid = static_cast<int> (reg.buffers.size ()) + 1 ;
+    bool gui = qApp && QThread::currentThread () == qApp->thread () ;
+    auto name = gui ? QString ("gui") : QString ("worker %1").arg (tid) ;
+
+    reg.buffers.emplace_back (new ThreadBuffer (tid, name)) ;
+    local_buffer = reg.buffers.back ().get () ;
+  }
+  return local_buffer ;
+}
+
+}
+
+void Trace::enable () {
+  auto & reg = registry () ;
+  {
+    QMutexLocker lock (&reg.mutex) ;
+    if (! reg.epoch.isValid ()) { reg.epoch.start () ; }
+  }
+  on.store (true, std::memory_order_release) ;
+}
+
+void Trace::disable () {
+  on.store (false, std::memory_order_release) ;
+}
+
+qint64 Trace::now () {
+  return registry ().epoch.nsecsElapsed () ;
+}
+
+void Trace::record (const char * name, qint64 start, qint64 end) {
+  auto buffer = thread_buffer () ;
+  auto head = buffer->head.load (std::memory_order_relaxed) ;
+  buffer->spans[head % capacity] = Span { name, start, end - start } ;
+  buffer->head.store (head + 1, std::memory_order_release) ;
+}
+
+bool Trace::dump (const QString & file) {
+  QJsonArray events ;
+
+  {
+    auto & reg = registry () ;
+    QMutexLocker lock (&reg.mutex) ;
+
+    for (const auto & buffer : reg.buffers) {
+      QJsonObject meta ;
+      meta["name"] = "thread_name" ;
+      meta["ph"] = "M" ;
+      meta["pid"] = 1 ;
+      meta["tid"] = buffer->tid ;
+      meta["args"] = QJsonObject { { "name", buffer->name } } ;
+      events << meta ;
+
+      auto head = buffer->head.load (std::memory_order_acquire) ;
+      auto count = qMin<quint64> (head, capacity) ;
+      for (auto i = head - count ; i < head ; i++) {
+        const auto & span = buffer->spans.at (i % capacity) ;
+
+        QJsonObject event ;
+        event["name"] = span.name ;
+        event["cat"] = "imview" ;
+        event["ph"] = "X" ;
+        event["ts"] = span.start / 1e3 ;
+        event["dur"] = span.duration / 1e3 ;
+        event["pid"] = 1 ;
+        event["tid"] = buffer->tid ;
+        events << event ;
+      }
+    }
+  }
+
+  QJsonObject trace ;
+  trace["traceEvents"] = events ;
+  trace["displayTimeUnit"] = "ms" ;
+
+  QFile out (file) ;
+  if (! out.open (QIODevice::WriteOnly | QIODevice::Truncate)) {
+    cerr << "trace : cannot write " << file.toStdString () << endl ;
+    return false ;
+  }
+  out.write (QJsonDocument (trace).toJson (QJsonDocument::Compact)) ;
+  cerr << "trace : " << events.size () << " events written to "
+       << file.toStdString () << endl ;
+  return true ;
+}
@@ -3,8 +3,14 @@
 
 int
 main (int argc, char ** argv) {
+  if (Application::is_headless (argc, argv) &&
+      qEnvironmentVariableIsEmpty ("QT_QPA_PLATFORM")) {
+    qputenv ("QT_QPA_PLATFORM", "offscreen") ;
+  }
+
   auto _app = Application (argc, argv) ;
+  if (app->headless ()) { return app->exec_headless () ; }
+
   auto wnd = MainWindow () ;
   return app->exec (&wnd) ;
 }
-